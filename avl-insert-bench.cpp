@@ -0,0 +1,55 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+/**
+ * Inserts n random uint64_t keys into an empty AVLTree and returns the
+ * elapsed wall time in nanoseconds.
+ */
+double timeInserts(size_t n, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+
+    AVLTree<uint64_t, uint64_t> tree;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(std::make_pair(keys[i], keys[i]));
+    }
+    chrono::steady_clock::time_point stop = chrono::steady_clock::now();
+
+    return chrono::duration<double, nano>(stop - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t maxN = 1000000;
+    if(argc > 1) {
+        maxN = strtoul(argv[1], NULL, 10);
+    }
+
+    // If insert is O(log n) the last column stays roughly flat as n doubles.
+    cout << setw(10) << "n" << setw(14) << "total ms"
+         << setw(14) << "ns/insert" << setw(18) << "ns/(insert*lg n)" << endl;
+    for(size_t n = maxN / 8; n <= maxN; n *= 2) {
+        double ns = timeInserts(n, 104);
+        cout << setw(10) << n
+             << setw(14) << fixed << setprecision(1) << ns / 1e6
+             << setw(14) << ns / n
+             << setw(18) << setprecision(2) << ns / (n * log2((double)n)) << endl;
+    }
+
+    return 0;
+}
@@ -6,37 +6,157 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <type_traits>
+#include <stdexcept>
+#include <atomic>
+#include <string>
 #include "bst.h"
+#include "fork-levels.h"
+
+// In a -DDEBUG build every AVLTree runs verify() after this many
+// mutations; 0 leaves the checks off until setVerifyInterval is called.
+#ifndef AVL_VERIFY_INTERVAL
+#define AVL_VERIFY_INTERVAL 0
+#endif
 
 struct KeyError { };
 
 /**
-* A special kind of node for an AVL tree, which adds the balance as a data member, plus
-* other additional helper functions. You do NOT need to implement any functionality or
-* add additional data members or helper functions.
+* The default event hook for an AVLTree. Every callback is an empty inline
+* member, so a tree using it pays nothing for the hook calls. A custom hook
+* must provide the same members; it is stored by value in the tree and can
+* be reached through AVLTree::getTrace().
+*/
+struct NoTrace
+{
+    template<typename NodeT> void onRotateLeft(const NodeT*) {}
+    template<typename NodeT> void onRotateRight(const NodeT*) {}
+    template<typename NodeT> void onNodeSwap(const NodeT*, const NodeT*) {}
+    template<typename KeyT> void onRemoveNotFound(const KeyT&) {}
+};
+
+/**
+* An event hook that writes one line per tree event to a stream (std::clog
+* unless another stream is given). Lines end with '\n' rather than
+* std::endl so that tracing does not force a flush per event.
+*/
+class StreamTrace
+{
+public:
+    StreamTrace(std::ostream& out = std::clog) : out_(&out) {}
+
+    template<typename NodeT> void onRotateLeft(const NodeT* x)
+    {
+        *out_ << "rotateLeft " << x->getKey() << '\n';
+    }
+    template<typename NodeT> void onRotateRight(const NodeT* z)
+    {
+        *out_ << "rotateRight " << z->getKey() << '\n';
+    }
+    template<typename NodeT> void onNodeSwap(const NodeT* n1, const NodeT* n2)
+    {
+        *out_ << "nodeSwap " << n1->getKey() << ' ' << n2->getKey() << '\n';
+    }
+    template<typename KeyT> void onRemoveNotFound(const KeyT& key)
+    {
+        *out_ << "remove not found " << key << '\n';
+    }
+
+private:
+    std::ostream* out_;
+};
+
+/**
+* Node augmentation policies for an AVLTree. The policy is a base class of
+* AVLNode, so it can carry extra per-node data, and the tree calls
+* update(node) whenever node's children change (rotations, bulk load) and
+* adjustPath(node, delta) when a node is linked below or unlinked from
+* node. NoAugment is empty and costs nothing.
 */
-template <typename Key, typename Value>
-class AVLNode : public Node<Key, Value>
+struct NoAugment
+{
+    template<typename NodeT> static void update(NodeT*) {}
+    template<typename NodeT> static void adjustPath(NodeT*, int) {}
+};
+
+/**
+* Keeps the number of nodes in each subtree, which AVLTree uses for the
+* order-statistic queries rank(), select() and countInRange().
+*/
+class SubtreeSize
+{
+public:
+    SubtreeSize() : subtreeSize_(1) {}
+
+    size_t getSubtreeSize() const { return subtreeSize_; }
+
+    template<typename NodeT>
+    static size_t sizeOf(const NodeT* node)
+    {
+        return node == nullptr ? 0 : node->subtreeSize_;
+    }
+
+    template<typename NodeT>
+    static void update(NodeT* node)
+    {
+        node->subtreeSize_ = 1 + sizeOf(node->getLeft()) + sizeOf(node->getRight());
+    }
+
+    template<typename NodeT>
+    static void adjustPath(NodeT* node, int delta)
+    {
+        for(; node != nullptr; node = node->getParent()) {
+            node->subtreeSize_ += delta;
+        }
+    }
+
+protected:
+    size_t subtreeSize_;
+};
+
+/**
+* Runs the two halves of a divide-and-conquer step one after the other.
+* This is what the set operations use unless they are handed a pool; a
+* pool provides the same invoke and may run f and g in parallel.
+*/
+struct SerialInvoker
+{
+    template<typename F, typename G>
+    void invoke(F f, G g)
+    {
+        f();
+        g();
+    }
+};
+
+/**
+* A special kind of node for an AVL tree, which adds the balance, plus other
+* additional helper functions. The balance lives in the tag bits beside the
+* parent pointer, so an AVLNode is no larger than a plain Node unless the
+* Augment policy adds data of its own.
+*/
+template <typename Key, typename Value, typename Augment = NoAugment>
+class AVLNode : public Node<Key, Value>, public Augment
 {
 public:
     // Constructor/destructor.
-    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* p);
-    virtual ~AVLNode();
+    AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment>* p);
+    template<typename... Args>
+    explicit AVLNode(AVLNode<Key, Value, Augment>* p, Args&&... itemArgs);
+    AVLNode(ItemSource<Key, Value>& source, AVLNode<Key, Value, Augment>* p);
+    ~AVLNode();
 
     // Getter/setter for the node's height.
     int8_t getBalance () const;
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
-    // Getters for p, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
-
-protected:
-    int8_t balance_;    // effectively a signed char
+    // Getters for p, left, and right. These hide the Node versions since
+    // they return pointers to AVLNodes - not plain Nodes. See the Node class
+    // in bst.h for more information.
+    AVLNode<Key, Value, Augment>* getParent() const;
+    AVLNode<Key, Value, Augment>* getLeft() const;
+    AVLNode<Key, Value, Augment>* getRight() const;
 };
 
 /*
@@ -48,9 +168,27 @@ protected:
 /**
 * An explicit constructor to initialize the elements by calling the base class constructor
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *p) :
-    Node<Key, Value>(key, value, p), balance_(0)
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value, Augment> *p) :
+    Node<Key, Value>(key, value, p)
+{
+
+}
+
+/**
+* Builds the item in place; see the matching Node constructor.
+*/
+template<class Key, class Value, class Augment>
+template<typename... Args>
+AVLNode<Key, Value, Augment>::AVLNode(AVLNode<Key, Value, Augment>* p, Args&&... itemArgs) :
+    Node<Key, Value>(p, std::forward<Args>(itemArgs)...)
+{
+
+}
+
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::AVLNode(ItemSource<Key, Value>& source, AVLNode<Key, Value, Augment>* p) :
+    Node<Key, Value>(source, p)
 {
 
 }
@@ -58,8 +196,8 @@ AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Va
 /**
 * A destructor which does nothing.
 */
-template<class Key, class Value>
-AVLNode<Key, Value>::~AVLNode()
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment>::~AVLNode()
 {
 
 }
@@ -67,56 +205,58 @@ AVLNode<Key, Value>::~AVLNode()
 /**
 * A getter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-int8_t AVLNode<Key, Value>::getBalance() const
+template<class Key, class Value, class Augment>
+int8_t AVLNode<Key, Value, Augment>::getBalance() const
 {
-    return balance_;
+    // Sign-extend the three tag bits: 0..3 stay positive, 4..7 map to -4..-1
+    int8_t balance = static_cast<int8_t>(this->getTag());
+    return (balance & 4) ? balance - 8 : balance;
 }
 
 /**
 * A setter for the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::setBalance(int8_t balance)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::setBalance(int8_t balance)
 {
-    balance_ = balance;
+    this->setTag(static_cast<uintptr_t>(balance));
 }
 
 /**
 * Adds diff to the balance of a AVLNode.
 */
-template<class Key, class Value>
-void AVLNode<Key, Value>::updateBalance(int8_t diff)
+template<class Key, class Value, class Augment>
+void AVLNode<Key, Value, Augment>::updateBalance(int8_t diff)
 {
-    balance_ += diff;
+    setBalance(getBalance() + diff);
 }
 
 /**
-* An overridden function for getting the p since a static_cast is necessary to make sure
-* that our node is a AVLNode.
+* A getter for the p that hides the Node version, since a static_cast is necessary to
+* make sure that our node is a AVLNode.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getParent() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->parent_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(Node<Key, Value>::getParent());
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getLeft() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->left_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->left_);
 }
 
 /**
-* Overridden for the same reasons as above.
+* Hidden for the same reasons as above.
 */
-template<class Key, class Value>
-AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
+template<class Key, class Value, class Augment>
+AVLNode<Key, Value, Augment> *AVLNode<Key, Value, Augment>::getRight() const
 {
-    return static_cast<AVLNode<Key, Value>*>(this->right_);
+    return static_cast<AVLNode<Key, Value, Augment>*>(this->right_);
 }
 
 
@@ -127,237 +267,1184 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+/**
+* A templated AVL tree. Trace is the event hook policy (see NoTrace) that is
+* told about rotations, node swaps and removes of missing keys, Alloc is
+* the node allocation policy (see node-alloc.h), Augment is the node
+* augmentation policy (see NoAugment and SubtreeSize), and Compare orders
+* the keys as in BinarySearchTree.
+*/
+template <class Key, class Value, class Trace = NoTrace, class Alloc = NewNodeAllocator,
+          class Augment = NoAugment, class Compare = std::less<Key> >
+class AVLTree : public BinarySearchTree<Key, Value, Alloc, Compare>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
-    virtual void remove(const Key& key);  // TODO
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    template<typename FwdIter>
+    AVLTree(FwdIter first, FwdIter last);
+    virtual ~AVLTree();
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator iterator;
+    typedef typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator const_iterator;
+
+    // insert (hinted or not), emplace, try_emplace and insert_or_assign are
+    // inherited; they build AVLNodes through createNode and rebalance in
+    // afterInsert
+    using BinarySearchTree<Key, Value, Alloc, Compare>::insert;
+    virtual void remove(const Key& key);
+    template<typename K, typename = typename std::enable_if<HeterogeneousKey<Key, Compare, K>::value>::type>
+    void remove(const K& key);
+
+    Trace& getTrace();
+    const Trace& getTrace() const;
+
+    // Order statistics; these need the SubtreeSize augmentation
+    size_t size() const;
+    size_t rank(const Key& key) const;
+    typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator select(size_t k) const;
+    size_t countInRange(const Key& lo, const Key& hi) const;
+
+    // Join, split and set operations. They move nodes from one tree to
+    // another, so the allocator must be able to free any tree's nodes.
+    void join(AVLTree& right);
+    void join(const std::pair<const Key, Value>& pivot, AVLTree& right);
+    void split(const Key& key, AVLTree& right);
+    void unionWith(AVLTree& other);
+    void intersectWith(AVLTree& other);
+    void subtract(AVLTree& other);
+
+    // Parallel versions; pool runs independent halves (see SerialInvoker)
+    template<typename Pool>
+    void unionWith(AVLTree& other, Pool& pool);
+    template<typename Pool>
+    void intersectWith(AVLTree& other, Pool& pool);
+    template<typename Pool>
+    void subtract(AVLTree& other, Pool& pool);
+
+    // Invariant checks: parent links, key order, balances and the cached
+    // ends. verify throws std::logic_error naming the first failure.
+    void verify() const;
+    template<typename Pool>
+    void verify(Pool& pool) const;
+    void setVerifyInterval(size_t mutations);
 protected:
-    virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
+    virtual void nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2);
+    virtual void destroyNode(Node<Key, Value>* node);
+    virtual void afterBuild(Node<Key, Value>* node, int leftHeight, int rightHeight);
+    virtual void afterLoad();
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual void afterInsert(Node<Key, Value>* node);
+    virtual Node<Key, Value>* createNode(ItemSource<Key, Value>& source);
+    virtual void eraseRange(Node<Key, Value>* first, Node<Key, Value>* last);
 
     // Add helper functions here
-		void rotateRight(AVLNode<Key, Value>* z);
-		void rotateLeft(AVLNode<Key, Value>* x);
-		void insertFix(AVLNode<Key, Value>* n, AVLNode<Key, Value>* p);
-		void removeFix(AVLNode<Key, Value>* n, int8_t diff);
-
-		void updateBalanceAndRotate(AVLNode<Key, Value>* node);
-		int8_t getHeight(AVLNode<Key, Value>* node) const;
+		void rotateRight(AVLNode<Key, Value, Augment>* z);
+		void rotateLeft(AVLNode<Key, Value, Augment>* x);
+		void insertFix(AVLNode<Key, Value, Augment>* p, AVLNode<Key, Value, Augment>* n);
+		void removeFix(AVLNode<Key, Value, Augment>* n, int8_t diff);
+    size_t countLess(const Key& key, bool orEqual) const;
+
+    // Join and split on detached subtrees. Heights are not stored, so they
+    // are passed alongside each subtree root and worked out from balances.
+    // rotateLeft/rotateRight expect nodes linked under root_, so joinRight
+    // and joinLeft relink the nodes themselves and report each rotation to
+    // the trace as those would.
+    static int subtreeHeight(AVLNode<Key, Value, Augment>* n);
+    static void childHeights(AVLNode<Key, Value, Augment>* n, int h, int& hl, int& hr);
+    static int link(AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* l, AVLNode<Key, Value, Augment>* r, int hl, int hr);
+    AVLNode<Key, Value, Augment>* joinNodes(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* r, int hr, int& h);
+    AVLNode<Key, Value, Augment>* joinRight(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* r, int hr, int& h);
+    AVLNode<Key, Value, Augment>* joinLeft(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* r, int hr, int& h);
+    template<typename K>
+    void splitNodes(AVLNode<Key, Value, Augment>* t, int ht, const K& key, AVLNode<Key, Value, Augment>*& l, int& hl,
+               AVLNode<Key, Value, Augment>*& m, AVLNode<Key, Value, Augment>*& r, int& hr);
+    void setRoot(AVLNode<Key, Value, Augment>* root);
+    AVLNode<Key, Value, Augment>* joinNodes(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* r, int hr, int& h);
+    AVLNode<Key, Value, Augment>* splitLast(AVLNode<Key, Value, Augment>* t, int ht, AVLNode<Key, Value, Augment>*& last, int& h);
+    template<typename Invoker>
+    AVLNode<Key, Value, Augment>* unionNodes(AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb, int& h, Invoker& invoker);
+    template<typename Invoker>
+    AVLNode<Key, Value, Augment>* intersectNodes(AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb, int& h, Invoker& invoker);
+    template<typename Invoker>
+    AVLNode<Key, Value, Augment>* subtractNodes(AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb, int& h, Invoker& invoker);
+    void checkMovable(const AVLTree& other) const;
+
+    struct VerifyState
+    {
+        VerifyState() : failed(false) {}
+
+        std::atomic<bool> failed;
+        std::string error; // written once, by whoever sets failed
+    };
+    template<typename Invoker>
+    int verifyNodes(AVLNode<Key, Value, Augment>* n, AVLNode<Key, Value, Augment>* parent, const Key* lo, const Key* hi,
+                    int depth, int forkDepth, Invoker& invoker, VerifyState& state) const;
+    static int verifyFailed(VerifyState& state, const char* what, int depth);
+    static bool augmentMatches(const SubtreeSize* augment, AVLNode<Key, Value, Augment>* n);
+    static bool augmentMatches(const void* augment, AVLNode<Key, Value, Augment>* n);
+    template<typename Invoker>
+    void verifyWith(int forkDepth, Invoker& invoker) const;
+    void checkpoint();
+
+    static const int PARALLEL_MIN_HEIGHT = 14;
+
+    Trace trace_;
+    size_t verifyInterval_; // mutations between verify calls, 0 for never
+    size_t mutations_;
 };
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert(const std::pair<const Key, Value> &new_item)
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::AVLTree() :
+    verifyInterval_(AVL_VERIFY_INTERVAL),
+    mutations_(0)
 {
-    if (this->root_ == nullptr) {
-        // If the tree is empty, create a new root node
-        this->root_ = new AVLNode<Key,Value>(new_item.first, new_item.second, nullptr);
-        return;
-    }
 
-    AVLNode<Key, Value>* current = static_cast<AVLNode<Key, Value>*>(this->root_);
-    AVLNode<Key, Value>* parent = nullptr;
+}
 
-    // Traverse the tree to find the insertion point
-    while (current != nullptr) {
-        parent = current;
+/**
+* Constructor for a tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Alloc, Compare>(comp),
+    verifyInterval_(AVL_VERIFY_INTERVAL),
+    mutations_(0)
+{
 
-        if (new_item.first < current->getKey()) {
-            current = current->getLeft();
-        } else if (new_item.first > current->getKey()) {
-            current = current->getRight();
-        } else {
-            // If the key already exists, update the value and return
-            current->setValue(new_item.second);
-            return;
+}
+
+/**
+* Builds a perfectly balanced tree from [first, last); see bulkLoad.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename FwdIter>
+AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::AVLTree(FwdIter first, FwdIter last) :
+    verifyInterval_(AVL_VERIFY_INTERVAL),
+    mutations_(0)
+{
+    this->bulkLoad(first, last);
+}
+
+/**
+* Clears the tree here rather than in ~BinarySearchTree, where destroyNode
+* would no longer dispatch to the AVLNode version.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::~AVLTree()
+{
+    this->clear();
+}
+
+/**
+* Allocates an AVLNode; the inherited insertion functions and bulkLoad all
+* build their nodes here.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+Node<Key, Value>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::createNode(ItemSource<Key, Value>& source)
+{
+    return this->alloc_.template create<AVLNode<Key, Value, Augment> >(
+        source, static_cast<AVLNode<Key, Value, Augment>*>(nullptr));
+}
+
+/**
+* Restores the AVL balances after linkNode has hung a new leaf.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::afterInsert(Node<Key, Value>* node)
+{
+    AVLNode<Key, Value, Augment>* new_node = static_cast<AVLNode<Key, Value, Augment>*>(node);
+    AVLNode<Key, Value, Augment>* parent = new_node->getParent();
+    if (parent != nullptr) {
+        Augment::adjustPath(parent, 1);
+
+        // Only the balances along the insertion path can change. If the parent
+        // was leaning, the new node evens it out and no ancestor height changes;
+        // otherwise walk up with insertFix until a rotation or a zero balance.
+        if (parent->getBalance() != 0) {
+            parent->setBalance(0);
+        }
+        else {
+            parent->setBalance(new_node == parent->getLeft() ? -1 : 1);
+            insertFix(parent, new_node);
         }
     }
+    checkpoint();
+}
 
-    // Create a new node with the given key and value
-    AVLNode<Key, Value>* new_node = new AVLNode<Key, Value>(new_item.first, new_item.second, parent);
+/**
+* Returns the event hook so callers can inspect what it recorded.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+Trace& AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::getTrace()
+{
+    return trace_;
+}
 
-    // Attach the new node to the correct side of the parent
-    if (new_item.first < parent->getKey()) {
-        parent->setLeft(new_node);
-    } else {
-        parent->setRight(new_node);
-    }
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+const Trace& AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::getTrace() const
+{
+    return trace_;
+}
 
-    // Update balance factors and perform rotations if necessary
-    updateBalanceAndRotate(parent);
+/**
+* Returns the number of items in the tree in O(1).
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+size_t AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::size() const
+{
+    static_assert(std::is_base_of<SubtreeSize, Augment>::value,
+                  "order statistics need AVLTree's Augment to be SubtreeSize");
+    return SubtreeSize::sizeOf(static_cast<AVLNode<Key, Value, Augment>*>(this->root_));
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::updateBalanceAndRotate(AVLNode<Key, Value>* node)
+/**
+* Returns the number of keys strictly less than key, i.e. the 0-based
+* position key has or would have in sorted order.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+size_t AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::rank(const Key& key) const
 {
-    while (node != nullptr) {
-        // Update balance factor of the current node
-        int8_t left_height = getHeight(node->getLeft());
-        int8_t right_height = getHeight(node->getRight());
-        int8_t balance_factor = right_height - left_height;
-        node->setBalance(balance_factor);
+    return countLess(key, false);
+}
 
-        // Perform rotations if necessary
-        if (balance_factor < -1) {
-            if (getHeight(node->getLeft()->getRight()) > getHeight(node->getLeft()->getLeft())) {
-                // Left-Right case
-                rotateLeft(node->getLeft());
-            }
-            // Left-Left case
-            rotateRight(node);
-        } else if (balance_factor > 1) {
-            if (getHeight(node->getRight()->getLeft()) > getHeight(node->getRight()->getRight())) {
-                // Right-Left case
-                rotateRight(node->getRight());
-            }
-            // Right-Right case
-            rotateLeft(node);
-        }
+/**
+* Returns an iterator to the k-th smallest item (0-based), or end() if
+* k >= size().
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::select(size_t k) const
+{
+    static_assert(std::is_base_of<SubtreeSize, Augment>::value,
+                  "order statistics need AVLTree's Augment to be SubtreeSize");
 
-        // Move up one level in the tree
-        node = node->getParent();
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while (n != nullptr) {
+        size_t leftSize = SubtreeSize::sizeOf(n->getLeft());
+        if (k < leftSize) {
+            n = n->getLeft();
+        } else if (k == leftSize) {
+            break;
+        } else {
+            k -= leftSize + 1;
+            n = n->getRight();
+        }
     }
+    return this->makeIterator(n);
 }
 
-template<class Key, class Value>
-int8_t AVLTree<Key, Value>::getHeight(AVLNode<Key, Value>* node) const
+/**
+* Returns the number of keys with lo <= key <= hi.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+size_t AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::countInRange(const Key& lo, const Key& hi) const
 {
-    if (node == nullptr) {
+    if (this->keyLess(hi, lo)) {
         return 0;
     }
-    // Height of the node is 1 + maximum height of its children
-    return 1 + std::max(getHeight(node->getLeft()), getHeight(node->getRight()));
+    return countLess(hi, true) - countLess(lo, false);
+}
+
+/**
+* Counts the keys less than key (or less than or equal to it) with one
+* descent, adding up the left subtree sizes passed on the way down.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+size_t AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::countLess(const Key& key, bool orEqual) const
+{
+    static_assert(std::is_base_of<SubtreeSize, Augment>::value,
+                  "order statistics need AVLTree's Augment to be SubtreeSize");
+
+    size_t count = 0;
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    while (n != nullptr) {
+        bool goRight = orEqual ? !this->keyLess(key, n->getKey())
+                               : this->keyLess(n->getKey(), key);
+        if (goRight) {
+            count += SubtreeSize::sizeOf(n->getLeft()) + 1;
+            n = n->getRight();
+        } else {
+            n = n->getLeft();
+        }
+    }
+    return count;
+}
+
+/**
+* Gives each node bulkLoad builds the balance of its subtrees and its
+* augmented data, so the tree comes out as a valid AVL tree.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::afterBuild(Node<Key, Value>* node, int leftHeight, int rightHeight)
+{
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(node);
+    n->setBalance(rightHeight - leftHeight);
+    Augment::update(n);
+}
+
+/**
+* Called once bulkLoad has installed the new root, so a loaded tree reaches
+* the verify checkpoint like any other mutation.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::afterLoad()
+{
+    checkpoint();
 }
 
 /*
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template <class Key, class Value>
-void AVLTree<Key, Value>::remove(const Key& key) {
-    // Find node to remove (n) by walking the tree
-    AVLNode<Key, Value>* n = static_cast<AVLNode<Key,Value>*>(this->root_);
-    while (n != nullptr && key != n->getKey()) {
-        if (key < n->getKey()) {
-            n = n->getLeft();
-        } else {
-            n = n->getRight();
-        }
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::remove(const Key& key) {
+    // Find node to remove by walking the tree
+    Node<Key, Value>* n = this->internalFind(key);
+
+    // If node not found, report it and return
+    if (n == nullptr) {
+        trace_.onRemoveNotFound(key);
+        return;
     }
 
-    // If node not found, return
+    removeNode(n);
+}
+
+/**
+* Heterogeneous version of remove; see HeterogeneousKey.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename K, typename>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::remove(const K& key) {
+    Node<Key, Value>* n = this->internalFind(key);
+
     if (n == nullptr) {
-				std::cout << "Burger" << std::endl;
+        trace_.onRemoveNotFound(key);
         return;
     }
 
-    AVLNode<Key, Value>* p = n->getParent(); // Parent node of n
-    int8_t diff = 0; // Balance factor change
+    removeNode(n);
+}
 
-		std::cout << "Fries" << std::endl;
+/**
+* Unlinks a node that is known to be in the tree, deallocates it and
+* rebalances on the way up.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::removeNode(Node<Key, Value>* node) {
+    AVLNode<Key, Value, Augment>* n = static_cast<AVLNode<Key, Value, Augment>*>(node);
 
-    // Finds successor if  n has two children
+    // Swap with the predecessor if n has two children, so that n is left
+    // with at most one child
     if (n->getLeft() != nullptr && n->getRight() != nullptr) {
-				std::cout << "McDonald" << std::endl;
-        AVLNode<Key, Value>* pred = static_cast<AVLNode<Key, Value>*>(BinarySearchTree<Key, Value>::predecessor(n));
-				
-				nodeSwap(pred, n); //swaps n with successor
+        AVLNode<Key, Value, Augment>* pred = static_cast<AVLNode<Key, Value, Augment>*>(BinarySearchTree<Key, Value, Alloc, Compare>::predecessor(n));
+        nodeSwap(pred, n);
+    }
 
-				if(pred == this->root_){
-					if(pred->getLeft()->getKey() > pred->getKey()){
-						nodeSwap(pred->getRight(), pred->getLeft());
-						n = nullptr;
-						
-						return;
-					}
-				}
+    // Done after the swap, since nodeSwap moves the cached ends with it
+    if (n == this->leftmost_) {
+        this->leftmost_ = BinarySearchTree<Key, Value, Alloc, Compare>::successor(n);
+    }
+    if (n == this->rightmost_) {
+        this->rightmost_ = BinarySearchTree<Key, Value, Alloc, Compare>::predecessor(n);
     }
 
-    // Determine diff and adjust pointers if parent exists
-    if (p != nullptr) {
-        if (n == p->getLeft()) { // n is left child
-            diff = 1;
-            if (n->getLeft() != nullptr) {
-                p->setLeft(n->getLeft());
-            } 
-						
-						else {
-                p->setLeft(n->getRight());
-            }
-        } 
-				
-				else { // n is right child
-            diff = -1;
-            if (n->getLeft() != nullptr) {
-                p->setRight(n->getLeft());
-            } else {
-                p->setRight(n->getRight());
-            }
-        }
-        
-				if (n->getLeft() != nullptr || n->getRight() != nullptr) { // Update child's parent pointer
-            n->getLeft()->setParent(p);
-            n->getRight()->setParent(p);
-        }
-        delete n; // Delete node n
-    } 
-		else { // If n is the root
-        if(n->getLeft() != nullptr && n->getRight() != nullptr){
-					if(n->getKey() == key)
-					{
-						std::cout << "Ligma" << std::endl;
-					}
-				}
-				
-				else if (n->getLeft() != nullptr || n->getRight() != nullptr) { // Update child's parent pointer
-            if (n->getLeft() != nullptr) {
-                this->root_ = n->getLeft();
-            } else {
-                this->root_ = n->getRight();
-            }
-            this->root_->setParent(nullptr);
-        } 
-				
-				else { // If n has no children
-            this->root_ = nullptr;
-        }
-        delete n; // Delete node n
+    AVLNode<Key, Value, Augment>* p = n->getParent(); // Parent node of n
+    AVLNode<Key, Value, Augment>* child = (n->getLeft() != nullptr) ? n->getLeft() : n->getRight();
+    int8_t diff = 0; // Balance change at p
+
+    if (child != nullptr) {
+        child->setParent(p);
     }
 
-    // Patch tree by calling removeFix
-    if (p != nullptr) {
-        removeFix(p, diff);
+    if (p == nullptr) { // n is the root
+        this->root_ = child;
+    }
+    else if (n == p->getLeft()) { // n is left child
+        diff = 1;
+        p->setLeft(child);
+    }
+    else { // n is right child
+        diff = -1;
+        p->setRight(child);
     }
+    Augment::adjustPath(p, -1);
+
+    destroyNode(n); // Delete node n
+
+    // Patch tree by calling removeFix
+    removeFix(p, diff);
+    checkpoint();
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::nodeSwap( AVLNode<Key, Value, Augment>* n1, AVLNode<Key, Value, Augment>* n2)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    trace_.onNodeSwap(n1, n2);
+    BinarySearchTree<Key, Value, Alloc, Compare>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    std::swap(static_cast<Augment&>(*n1), static_cast<Augment&>(*n2));
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::destroyNode(Node<Key, Value>* node)
+{
+    this->alloc_.destroy(static_cast<AVLNode<Key, Value, Augment>*>(node));
+}
+
+/**
+* Removes [first, last) in O(k + log n). Short ranges are removed node by
+* node. Longer ones are cut out whole: split at last's key, split the left
+* part at first's key, free the middle, and join what is left back
+* together around last's node.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::eraseRange(Node<Key, Value>* first, Node<Key, Value>* last)
+{
+    const int SHORT_RANGE = 16;
+    Node<Key, Value>* scan = first;
+    for (int i = 0; i < SHORT_RANGE && scan != last; ++i) {
+        scan = BinarySearchTree<Key, Value, Alloc, Compare>::successor(scan);
+    }
+    if (scan == last) {
+        BinarySearchTree<Key, Value, Alloc, Compare>::eraseRange(first, last);
+        return;
+    }
+
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    int h = subtreeHeight(root);
+    AVLNode<Key, Value, Augment>* before = root;
+    int hBefore = h;
+    AVLNode<Key, Value, Augment>* lastNode = nullptr;
+    AVLNode<Key, Value, Augment>* after = nullptr;
+    int hAfter = 0;
+    if (last != nullptr) {
+        splitNodes(root, h, last->getKey(), before, hBefore, lastNode, after, hAfter);
+    }
+
+    AVLNode<Key, Value, Augment>* kept;
+    int hKept;
+    AVLNode<Key, Value, Augment>* firstNode;
+    AVLNode<Key, Value, Augment>* middle;
+    int hMiddle;
+    splitNodes(before, hBefore, first->getKey(), kept, hKept, firstNode, middle, hMiddle);
+    this->destroyNode(firstNode);
+    this->totalDeletion(middle);
+
+    if (lastNode != nullptr) {
+        kept = joinNodes(kept, hKept, lastNode, after, hAfter, hKept);
+    }
+    setRoot(kept);
+}
+
+/**
+* Makes root the root of the tree and refreshes the cached ends. The
+* operations that move whole subtrees end here, so it is also where they
+* reach the verify checkpoint.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::setRoot(AVLNode<Key, Value, Augment>* root)
+{
+    if (root != nullptr) {
+        root->setParent(nullptr);
+    }
+    this->root_ = root;
+    this->leftmost_ = BinarySearchTree<Key, Value, Alloc, Compare>::findSmallest(root);
+    this->rightmost_ = BinarySearchTree<Key, Value, Alloc, Compare>::findLargest(root);
+    checkpoint();
+}
+
+/**
+* Appends every item of right to this tree, leaving right empty. All of
+* right's keys must be greater than all of this tree's, which is checked
+* in O(1) against the cached ends; std::invalid_argument is thrown if not.
+* Runs in O(log n).
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::join(AVLTree& right)
+{
+    checkMovable(right);
+    if (!this->empty() && !right.empty() &&
+        !this->keyLess(this->rightmost_->getKey(), right.leftmost_->getKey())) {
+        throw std::invalid_argument("join: right tree keys must be greater");
+    }
+    AVLNode<Key, Value, Augment>* l = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* r = static_cast<AVLNode<Key, Value, Augment>*>(right.root_);
+    int h;
+    right.setRoot(nullptr);
+    setRoot(joinNodes(l, subtreeHeight(l), r, subtreeHeight(r), h));
+}
+
+/**
+* As join(right), with pivot placed between the two trees' keys.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::join(const std::pair<const Key, Value>& pivot, AVLTree& right)
+{
+    checkMovable(right);
+    if ((!this->empty() && !this->keyLess(this->rightmost_->getKey(), pivot.first)) ||
+        (!right.empty() && !this->keyLess(pivot.first, right.leftmost_->getKey()))) {
+        throw std::invalid_argument("join: pivot must lie between the two trees");
+    }
+    AVLNode<Key, Value, Augment>* m = this->alloc_.template create<AVLNode<Key, Value, Augment> >(static_cast<AVLNode<Key, Value, Augment>*>(nullptr), pivot);
+    AVLNode<Key, Value, Augment>* l = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* r = static_cast<AVLNode<Key, Value, Augment>*>(right.root_);
+    int h;
+    right.setRoot(nullptr);
+    setRoot(joinNodes(l, subtreeHeight(l), m, r, subtreeHeight(r), h));
+}
+
+/**
+* Moves every item with a key not less than key into right, replacing
+* whatever right held before, and keeps the rest. Runs in O(log n).
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::split(const Key& key, AVLTree& right)
+{
+    checkMovable(right);
+    right.clear();
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* m;
+    AVLNode<Key, Value, Augment>* r;
+    int hl, hr;
+    splitNodes(root, subtreeHeight(root), key, l, hl, m, r, hr);
+    if (m != nullptr) {
+        r = joinNodes(nullptr, 0, m, r, hr, hr);
+    }
+    setRoot(l);
+    right.setRoot(r);
+}
+
+/**
+* Moves the items of other into this tree, leaving other empty. Where
+* both trees hold a key, this tree's value is kept. With m the smaller
+* and n the larger size, this runs in O(m log(n/m + 1)).
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::unionWith(AVLTree& other)
+{
+    SerialInvoker serial;
+    unionWith(other, serial);
+}
+
+/**
+* Keeps only the keys that other also holds, with this tree's values, and
+* empties other. Same bound as unionWith.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::intersectWith(AVLTree& other)
+{
+    SerialInvoker serial;
+    intersectWith(other, serial);
+}
+
+/**
+* Removes every key that other holds and empties other. Same bound as
+* unionWith.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::subtract(AVLTree& other)
+{
+    SerialInvoker serial;
+    subtract(other, serial);
+}
+
+/**
+* Parallel versions of unionWith, intersectWith and subtract. pool needs
+* a member invoke(f, g) that runs both callables and returns once both
+* are done, like WorkStealingPool in thread-pool.h. The allocator's
+* destroy must be safe to call from several threads at once, as it is
+* for NewNodeAllocator, and so must the Trace's rotation hooks, which the
+* joins call from those threads (NoTrace's do nothing).
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Pool>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::unionWith(AVLTree& other, Pool& pool)
+{
+    checkMovable(other);
+    AVLNode<Key, Value, Augment>* a = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* b = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    int h;
+    other.setRoot(nullptr);
+    setRoot(unionNodes(a, subtreeHeight(a), b, subtreeHeight(b), h, pool));
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Pool>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::intersectWith(AVLTree& other, Pool& pool)
+{
+    checkMovable(other);
+    AVLNode<Key, Value, Augment>* a = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* b = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    int h;
+    other.setRoot(nullptr);
+    setRoot(intersectNodes(a, subtreeHeight(a), b, subtreeHeight(b), h, pool));
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Pool>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::subtract(AVLTree& other, Pool& pool)
+{
+    checkMovable(other);
+    AVLNode<Key, Value, Augment>* a = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    AVLNode<Key, Value, Augment>* b = static_cast<AVLNode<Key, Value, Augment>*>(other.root_);
+    int h;
+    other.setRoot(nullptr);
+    setRoot(subtractNodes(a, subtreeHeight(a), b, subtreeHeight(b), h, pool));
+}
+
+/**
+* Node-moving operations need distinct trees, and nodes must outlive the
+* tree that allocated them, which rules out pools released in bulk.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::checkMovable(const AVLTree& other) const
+{
+    static_assert(!Alloc::BULK_RELEASE,
+                  "join, split and set operations need an allocator whose nodes can change trees");
+    if (&other == this) {
+        throw std::invalid_argument("join, split and set operations need two different trees");
+    }
+}
+
+/**
+* Checks the whole tree in one pass and throws std::logic_error describing
+* the first broken invariant: a child whose parent pointer is wrong, a key
+* out of order, a stored balance that differs from the real subtree
+* heights, a subtree size that is off, or stale leftmost and rightmost
+* nodes. Each node's height comes back from its children, so the walk is
+* O(n) rather than a height computation per node.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::verify() const
+{
+    SerialInvoker serial;
+    verifyWith(0, serial);
+}
+
+/**
+* verify, with the top levels of the walk split over pool. Pool needs only
+* size() and invoke(f, g), as WorkStealingPool provides. Trees shorter than
+* PARALLEL_MIN_HEIGHT are checked on the calling thread.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Pool>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::verify(Pool& pool) const
+{
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    if (subtreeHeight(root) < PARALLEL_MIN_HEIGHT) {
+        verify();
+        return;
+    }
+    verifyWith(forkLevelsFor(pool.size()), pool);
+}
+
+/**
+* In a -DDEBUG build, runs verify() after every mutations-th insert,
+* removal, bulk load or node-moving operation; 0 turns the checks off.
+* Other builds never run the checks.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::setVerifyInterval(size_t mutations)
+{
+    verifyInterval_ = mutations;
+    mutations_ = 0;
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Invoker>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::verifyWith(int forkDepth, Invoker& invoker) const
+{
+    AVLNode<Key, Value, Augment>* root = static_cast<AVLNode<Key, Value, Augment>*>(this->root_);
+    VerifyState state;
+    verifyNodes(root, nullptr, nullptr, nullptr, 0, forkDepth, invoker, state);
+    if (state.failed.load()) {
+        throw std::logic_error(state.error);
+    }
+    if (this->leftmost_ != BinarySearchTree<Key, Value, Alloc, Compare>::findSmallest(root) ||
+        this->rightmost_ != BinarySearchTree<Key, Value, Alloc, Compare>::findLargest(root)) {
+        throw std::logic_error("verify: leftmost or rightmost node is stale");
+    }
+}
+
+/**
+* Checks the subtree at n, whose keys must lie strictly between *lo and
+* *hi (either may be null for no bound), and returns its height, or -1
+* once any check has failed. Above forkDepth the two children are checked
+* through invoker; a task that fails records its error in state and the
+* others stop at their next node.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Invoker>
+int AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::verifyNodes(AVLNode<Key, Value, Augment>* n, AVLNode<Key, Value, Augment>* parent, const Key* lo, const Key* hi,
+                    int depth, int forkDepth, Invoker& invoker, VerifyState& state) const
+{
+    if (n == nullptr) {
+        return 0;
+    }
+    if (state.failed.load(std::memory_order_relaxed)) {
+        return -1;
+    }
+    if (n->getParent() != parent) {
+        return verifyFailed(state, "parent pointer does not match", depth);
+    }
+    if ((lo != nullptr && !this->keyLess(*lo, n->getKey())) ||
+        (hi != nullptr && !this->keyLess(n->getKey(), *hi))) {
+        return verifyFailed(state, "key out of order", depth);
+    }
+
+    AVLNode<Key, Value, Augment>* left = n->getLeft();
+    AVLNode<Key, Value, Augment>* right = n->getRight();
+    int hl, hr;
+    if (depth < forkDepth && left != nullptr && right != nullptr) {
+        invoker.invoke([&]() { hl = verifyNodes(left, n, lo, &n->getKey(), depth + 1, forkDepth, invoker, state); },
+                       [&]() { hr = verifyNodes(right, n, &n->getKey(), hi, depth + 1, forkDepth, invoker, state); });
+    }
+    else {
+        hl = verifyNodes(left, n, lo, &n->getKey(), depth + 1, forkDepth, invoker, state);
+        hr = verifyNodes(right, n, &n->getKey(), hi, depth + 1, forkDepth, invoker, state);
+    }
+    if (hl < 0 || hr < 0) {
+        return -1;
+    }
+
+    if (hr - hl < -1 || hr - hl > 1) {
+        return verifyFailed(state, "subtree heights differ by more than one", depth);
+    }
+    if (n->getBalance() != hr - hl) {
+        return verifyFailed(state, "balance does not match subtree heights", depth);
+    }
+    if (!augmentMatches(n, n)) {
+        return verifyFailed(state, "subtree size does not match", depth);
+    }
+    return 1 + std::max(hl, hr);
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+int AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::verifyFailed(VerifyState& state, const char* what, int depth)
+{
+    bool expected = false;
+    if (state.failed.compare_exchange_strong(expected, true)) {
+        state.error = std::string("verify: ") + what + " at depth " + std::to_string(depth);
+    }
+    return -1;
+}
+
+/**
+* Checks the augmentation data of n; only SubtreeSize has any to check.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+bool AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::augmentMatches(const SubtreeSize* augment, AVLNode<Key, Value, Augment>* n)
+{
+    return augment->getSubtreeSize() == 1 + SubtreeSize::sizeOf(n->getLeft()) + SubtreeSize::sizeOf(n->getRight());
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+bool AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::augmentMatches(const void*, AVLNode<Key, Value, Augment>*)
+{
+    return true;
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* z) {
+/**
+* In a -DDEBUG build, counts a mutation and runs verify() every
+* verifyInterval_ of them, so corruption is reported by the operation that
+* caused it rather than much later.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::checkpoint()
+{
+#ifdef DEBUG
+    if (verifyInterval_ != 0 && ++mutations_ % verifyInterval_ == 0) {
+        verify();
+    }
+#endif
+}
+
+/**
+* Joins l and r, every key of l being less than every key of r, using the
+* largest node of l as the pivot.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::joinNodes(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* r, int hr, int& h)
+{
+    if (l == nullptr) {
+        h = hr;
+        return r;
+    }
+    AVLNode<Key, Value, Augment>* last;
+    int hRest;
+    AVLNode<Key, Value, Augment>* rest = splitLast(l, hl, last, hRest);
+    return joinNodes(rest, hRest, last, r, hr, h);
+}
+
+/**
+* Detaches the largest node of the non-empty subtree t into last and
+* returns the rest, with its height in h.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::splitLast(AVLNode<Key, Value, Augment>* t, int ht, AVLNode<Key, Value, Augment>*& last, int& h)
+{
+    int ha, hb;
+    childHeights(t, ht, ha, hb);
+    AVLNode<Key, Value, Augment>* a = t->getLeft();
+    AVLNode<Key, Value, Augment>* b = t->getRight();
+    if (b == nullptr) {
+        last = t;
+        h = ha;
+        if (a != nullptr) a->setParent(nullptr);
+        return a;
+    }
+    int hRest;
+    AVLNode<Key, Value, Augment>* rest = splitLast(b, hb, last, hRest);
+    AVLNode<Key, Value, Augment>* joined = joinNodes(a, ha, t, rest, hRest, h);
+    joined->setParent(nullptr);
+    return joined;
+}
+
+/**
+* The set operations split one tree around the other's root, recurse on
+* the two halves and join the results back. The halves share no nodes,
+* so invoker may run them in parallel; below PARALLEL_MIN_HEIGHT the rest
+* of the recursion runs serially.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Invoker>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::unionNodes(AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb, int& h, Invoker& invoker)
+{
+    if (a == nullptr) {
+        h = hb;
+        return b;
+    }
+    if (b == nullptr) {
+        h = ha;
+        return a;
+    }
+    if (!std::is_same<Invoker, SerialInvoker>::value &&
+        (ha < PARALLEL_MIN_HEIGHT || hb < PARALLEL_MIN_HEIGHT)) {
+        SerialInvoker serial;
+        return unionNodes(a, ha, b, hb, h, serial);
+    }
+    AVLNode<Key, Value, Augment>* bl;
+    AVLNode<Key, Value, Augment>* bm;
+    AVLNode<Key, Value, Augment>* br;
+    int hbl, hbr;
+    splitNodes(b, hb, a->getKey(), bl, hbl, bm, br, hbr);
+    if (bm != nullptr) {
+        this->destroyNode(bm);
+    }
+    int hal, har, hl, hr;
+    childHeights(a, ha, hal, har);
+    AVLNode<Key, Value, Augment>* al = a->getLeft();
+    AVLNode<Key, Value, Augment>* ar = a->getRight();
+    if (al != nullptr) al->setParent(nullptr);
+    if (ar != nullptr) ar->setParent(nullptr);
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* r;
+    invoker.invoke([&]() { l = unionNodes(al, hal, bl, hbl, hl, invoker); },
+                   [&]() { r = unionNodes(ar, har, br, hbr, hr, invoker); });
+    AVLNode<Key, Value, Augment>* joined = joinNodes(l, hl, a, r, hr, h);
+    joined->setParent(nullptr);
+    return joined;
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Invoker>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::intersectNodes(AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb, int& h, Invoker& invoker)
+{
+    if (a == nullptr || b == nullptr) {
+        this->totalDeletion(a);
+        this->totalDeletion(b);
+        h = 0;
+        return nullptr;
+    }
+    if (!std::is_same<Invoker, SerialInvoker>::value &&
+        (ha < PARALLEL_MIN_HEIGHT || hb < PARALLEL_MIN_HEIGHT)) {
+        SerialInvoker serial;
+        return intersectNodes(a, ha, b, hb, h, serial);
+    }
+    AVLNode<Key, Value, Augment>* bl;
+    AVLNode<Key, Value, Augment>* bm;
+    AVLNode<Key, Value, Augment>* br;
+    int hbl, hbr;
+    splitNodes(b, hb, a->getKey(), bl, hbl, bm, br, hbr);
+    int hal, har, hl, hr;
+    childHeights(a, ha, hal, har);
+    AVLNode<Key, Value, Augment>* al = a->getLeft();
+    AVLNode<Key, Value, Augment>* ar = a->getRight();
+    if (al != nullptr) al->setParent(nullptr);
+    if (ar != nullptr) ar->setParent(nullptr);
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* r;
+    invoker.invoke([&]() { l = intersectNodes(al, hal, bl, hbl, hl, invoker); },
+                   [&]() { r = intersectNodes(ar, har, br, hbr, hr, invoker); });
+    AVLNode<Key, Value, Augment>* joined;
+    if (bm != nullptr) {
+        this->destroyNode(bm);
+        joined = joinNodes(l, hl, a, r, hr, h);
+    }
+    else {
+        this->destroyNode(a);
+        joined = joinNodes(l, hl, r, hr, h);
+    }
+    if (joined != nullptr) joined->setParent(nullptr);
+    return joined;
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename Invoker>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::subtractNodes(AVLNode<Key, Value, Augment>* a, int ha, AVLNode<Key, Value, Augment>* b, int hb, int& h, Invoker& invoker)
+{
+    if (a == nullptr || b == nullptr) {
+        this->totalDeletion(b);
+        h = ha;
+        return a;
+    }
+    if (!std::is_same<Invoker, SerialInvoker>::value &&
+        (ha < PARALLEL_MIN_HEIGHT || hb < PARALLEL_MIN_HEIGHT)) {
+        SerialInvoker serial;
+        return subtractNodes(a, ha, b, hb, h, serial);
+    }
+    AVLNode<Key, Value, Augment>* al;
+    AVLNode<Key, Value, Augment>* am;
+    AVLNode<Key, Value, Augment>* ar;
+    int hal, har, hl, hr;
+    splitNodes(a, ha, b->getKey(), al, hal, am, ar, har);
+    if (am != nullptr) {
+        this->destroyNode(am);
+    }
+    int hbl, hbr;
+    childHeights(b, hb, hbl, hbr);
+    AVLNode<Key, Value, Augment>* bl = b->getLeft();
+    AVLNode<Key, Value, Augment>* br = b->getRight();
+    if (bl != nullptr) bl->setParent(nullptr);
+    if (br != nullptr) br->setParent(nullptr);
+    this->destroyNode(b);
+    AVLNode<Key, Value, Augment>* l;
+    AVLNode<Key, Value, Augment>* r;
+    invoker.invoke([&]() { l = subtractNodes(al, hal, bl, hbl, hl, invoker); },
+                   [&]() { r = subtractNodes(ar, har, br, hbr, hr, invoker); });
+    AVLNode<Key, Value, Augment>* joined = joinNodes(l, hl, r, hr, h);
+    if (joined != nullptr) joined->setParent(nullptr);
+    return joined;
+}
+
+/**
+* Returns the height of the subtree at n by following the taller side.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+int AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::subtreeHeight(AVLNode<Key, Value, Augment>* n)
+{
+    int h = 0;
+    while (n != nullptr) {
+        ++h;
+        n = (n->getBalance() < 0) ? n->getLeft() : n->getRight();
+    }
+    return h;
+}
+
+/**
+* Sets hl and hr to the heights of the children of n, whose height is h.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::childHeights(AVLNode<Key, Value, Augment>* n, int h, int& hl, int& hr)
+{
+    hl = h - 1 - (n->getBalance() > 0 ? 1 : 0);
+    hr = h - 1 - (n->getBalance() < 0 ? 1 : 0);
+}
+
+/**
+* Makes l and r the children of m and returns m's new height. The two
+* heights may differ by at most one.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+int AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::link(AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* l, AVLNode<Key, Value, Augment>* r, int hl, int hr)
+{
+    m->setLeft(l);
+    m->setRight(r);
+    if (l != nullptr) l->setParent(m);
+    if (r != nullptr) r->setParent(m);
+    m->setBalance(hr - hl);
+    Augment::update(m);
+    return (hl > hr ? hl : hr) + 1;
+}
+
+/**
+* Joins the subtrees l and r, every key of l being less than m's and
+* every key of r greater, into one AVL subtree rooted at the returned node.
+* Costs O(|hl - hr| + 1). h receives the result's height; the caller sets
+* the root's parent.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::joinNodes(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* r, int hr, int& h)
+{
+    if (hl > hr + 1) {
+        return joinRight(l, hl, m, r, hr, h);
+    }
+    if (hr > hl + 1) {
+        return joinLeft(l, hl, m, r, hr, h);
+    }
+    h = link(m, l, r, hl, hr);
+    return m;
+}
+
+/**
+* join when l is the taller side: walk down l's right spine to a subtree
+* about as tall as r, hang m there, and rotate on the way back up.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::joinRight(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* r, int hr, int& h)
+{
+    AVLNode<Key, Value, Augment>* a = l->getLeft();
+    AVLNode<Key, Value, Augment>* c = l->getRight();
+    int ha, hc;
+    childHeights(l, hl, ha, hc);
+
+    if (hc <= hr + 1) {
+        int hm = link(m, c, r, hc, hr);
+        if (hm <= ha + 1) {
+            h = link(l, a, m, ha, hm);
+            return l;
+        }
+        // m is two taller than a, so c must be the tall child: double rotation
+        trace_.onRotateRight(m);
+        trace_.onRotateLeft(l);
+        AVLNode<Key, Value, Augment>* c1 = c->getLeft();
+        AVLNode<Key, Value, Augment>* c2 = c->getRight();
+        int hc1, hc2;
+        childHeights(c, hc, hc1, hc2);
+        int hl2 = link(l, a, c1, ha, hc1);
+        int hm2 = link(m, c2, r, hc2, hr);
+        h = link(c, l, m, hl2, hm2);
+        return c;
+    }
+
+    int ht;
+    AVLNode<Key, Value, Augment>* t = joinRight(c, hc, m, r, hr, ht);
+    if (ht <= ha + 1) {
+        h = link(l, a, t, ha, ht);
+        return l;
+    }
+    // Single left rotation at l
+    trace_.onRotateLeft(l);
+    AVLNode<Key, Value, Augment>* t1 = t->getLeft();
+    AVLNode<Key, Value, Augment>* t2 = t->getRight();
+    int ht1, ht2;
+    childHeights(t, ht, ht1, ht2);
+    int hl2 = link(l, a, t1, ha, ht1);
+    h = link(t, l, t2, hl2, ht2);
+    return t;
+}
+
+/**
+* Mirror image of joinRight, for when r is the taller side.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+AVLNode<Key, Value, Augment>* AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::joinLeft(AVLNode<Key, Value, Augment>* l, int hl, AVLNode<Key, Value, Augment>* m, AVLNode<Key, Value, Augment>* r, int hr, int& h)
+{
+    AVLNode<Key, Value, Augment>* c = r->getLeft();
+    AVLNode<Key, Value, Augment>* b = r->getRight();
+    int hc, hb;
+    childHeights(r, hr, hc, hb);
+
+    if (hc <= hl + 1) {
+        int hm = link(m, l, c, hl, hc);
+        if (hm <= hb + 1) {
+            h = link(r, m, b, hm, hb);
+            return r;
+        }
+        trace_.onRotateLeft(m);
+        trace_.onRotateRight(r);
+        AVLNode<Key, Value, Augment>* c1 = c->getLeft();
+        AVLNode<Key, Value, Augment>* c2 = c->getRight();
+        int hc1, hc2;
+        childHeights(c, hc, hc1, hc2);
+        int hm2 = link(m, l, c1, hl, hc1);
+        int hr2 = link(r, c2, b, hc2, hb);
+        h = link(c, m, r, hm2, hr2);
+        return c;
+    }
+
+    int ht;
+    AVLNode<Key, Value, Augment>* t = joinLeft(l, hl, m, c, hc, ht);
+    if (ht <= hb + 1) {
+        h = link(r, t, b, ht, hb);
+        return r;
+    }
+    // Single right rotation at r
+    trace_.onRotateRight(r);
+    AVLNode<Key, Value, Augment>* t1 = t->getLeft();
+    AVLNode<Key, Value, Augment>* t2 = t->getRight();
+    int ht1, ht2;
+    childHeights(t, ht, ht1, ht2);
+    int hr2 = link(r, t2, b, ht2, hb);
+    h = link(t, t1, r, ht1, hr2);
+    return t;
+}
+
+/**
+* Splits the subtree t into l (keys less than key) and r (keys greater),
+* detaching the node with key itself into m, or setting m to null if there
+* is none. Each level joins the part it leaves behind onto one side, and
+* those joins telescope to O(log n) in total.
+*/
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+template<typename K>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::splitNodes(AVLNode<Key, Value, Augment>* t, int ht, const K& key, AVLNode<Key, Value, Augment>*& l, int& hl,
+                AVLNode<Key, Value, Augment>*& m, AVLNode<Key, Value, Augment>*& r, int& hr)
+{
+    if (t == nullptr) {
+        l = r = m = nullptr;
+        hl = hr = 0;
+        return;
+    }
+    AVLNode<Key, Value, Augment>* a = t->getLeft();
+    AVLNode<Key, Value, Augment>* b = t->getRight();
+    int ha, hb;
+    childHeights(t, ht, ha, hb);
+
+    if (this->keyLess(key, t->getKey())) {
+        AVLNode<Key, Value, Augment>* rest;
+        int hRest;
+        splitNodes(a, ha, key, l, hl, m, rest, hRest);
+        r = joinNodes(rest, hRest, t, b, hb, hr);
+    }
+    else if (this->keyLess(t->getKey(), key)) {
+        AVLNode<Key, Value, Augment>* rest;
+        int hRest;
+        splitNodes(b, hb, key, rest, hRest, m, r, hr);
+        l = joinNodes(a, ha, t, rest, hRest, hl);
+    }
+    else {
+        l = a;
+        hl = ha;
+        r = b;
+        hr = hb;
+        m = t;
+    }
+    if (l != nullptr) l->setParent(nullptr);
+    if (r != nullptr) r->setParent(nullptr);
+}
+
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::rotateRight(AVLNode<Key, Value, Augment>* z) {
     if (z == nullptr) return; // Null pointer check
 
 		bool isLeft = false;
 
 		//Initialize pointers to the parent and child
-		AVLNode<Key, Value>* y = z->getLeft();
+		AVLNode<Key, Value, Augment>* y = z->getLeft();
 
 		if(y == nullptr){
 			return;
 		}
 
-		AVLNode<Key, Value>* c = y->getRight(); //Right node of y
-		AVLNode<Key, Value>* g = z->getParent();
+		trace_.onRotateRight(z);
+
+		AVLNode<Key, Value, Augment>* c = y->getRight(); //Right node of y
+		AVLNode<Key, Value, Augment>* g = z->getParent();
 
 		if(g != nullptr){
 			if(z == g->getLeft()){
@@ -387,14 +1474,17 @@ void AVLTree<Key, Value>::rotateRight(AVLNode<Key, Value>* z) {
 			if(isLeft) g->setLeft(y);
 			else g->setRight(y);
 		}
+
+		Augment::update(z);
+		Augment::update(y);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* x){
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::rotateLeft(AVLNode<Key, Value, Augment>* x){
     if (x == nullptr) return; // Null pointer check
 
 		//Initialize pointers to the parent and child
-		AVLNode<Key, Value>* y = x->getRight();
+		AVLNode<Key, Value, Augment>* y = x->getRight();
 
 		bool isLeft = false;
 
@@ -402,8 +1492,10 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* x){
 			return;
 		}
 
-		AVLNode<Key, Value>* b = y->getLeft(); //Left node of y
-		AVLNode<Key, Value>* g = x->getParent();
+		trace_.onRotateLeft(x);
+
+		AVLNode<Key, Value, Augment>* b = y->getLeft(); //Left node of y
+		AVLNode<Key, Value, Augment>* g = x->getParent();
 
 		if(g != nullptr){
 			if(x == g->getLeft()){
@@ -431,10 +1523,13 @@ void AVLTree<Key, Value>::rotateLeft(AVLNode<Key, Value>* x){
 			if(isLeft) g->setLeft(y);
 			else g->setRight(y);
 		}
+
+		Augment::update(x);
+		Augment::update(y);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* p, AVLNode<Key, Value>* n){
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::insertFix(AVLNode<Key, Value, Augment>* p, AVLNode<Key, Value, Augment>* n){
 	//n = child, p = parent, g = grandparent
 	//Checks if parent is empty or is the root
 	if (p == nullptr || p->getParent() == nullptr){
@@ -442,7 +1537,7 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* p, AVLNode<Key, Value>*
 		return;
 	}
 
-	AVLNode<Key, Value>* g = p->getParent();
+	AVLNode<Key, Value, Augment>* g = p->getParent();
 
 	//Checks if child is left node of parent
 	if(p == g->getLeft()){
@@ -525,10 +1620,10 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* p, AVLNode<Key, Value>*
 				rotateRight(p);
 				rotateLeft(g);
 
-				//Case 3a
-				if(n->getBalance() == -1){
+				//Case 3a (mirror of the left side)
+				if(n->getBalance() == 1){
 					p->setBalance(0);
-					g->setBalance(1);
+					g->setBalance(-1);
 					n->setBalance(0);
 				}
 
@@ -538,8 +1633,8 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* p, AVLNode<Key, Value>*
 					n->setBalance(0);
 				}
 
-				else if(n->getBalance() == 1){
-					p->setBalance(-1);
+				else if(n->getBalance() == -1){
+					p->setBalance(1);
 					g->setBalance(0);
 					n->setBalance(0);
 				}
@@ -548,15 +1643,13 @@ void AVLTree<Key, Value>::insertFix(AVLNode<Key, Value>* p, AVLNode<Key, Value>*
 	}
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int8_t diff) {
+template<class Key, class Value, class Trace, class Alloc, class Augment, class Compare>
+void AVLTree<Key, Value, Trace, Alloc, Augment, Compare>::removeFix(AVLNode<Key, Value, Augment>* n, int8_t diff) {
     if (n == nullptr) {
         return;
     }
 
-		//std::cout << n->getKey() << std::endl;
- 
-    AVLNode<Key, Value>* p = n->getParent();
+    AVLNode<Key, Value, Augment>* p = n->getParent();
     int8_t ndiff = 0;
 
     if (p != nullptr) {
@@ -571,14 +1664,12 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int8_t diff) {
 
     if (diff == -1) {
         if (n->getBalance() + diff == -2) {
-            AVLNode<Key, Value>* c = n->getLeft();
+            AVLNode<Key, Value, Augment>* c = n->getLeft();
 
             if (c->getBalance() == -1) {
                 rotateRight(n);
-								//std::cout << "Candy" << std::endl;
                 n->setBalance(0);
                 c->setBalance(0);
-								//std::cout << "Pog" << std::endl;
                 removeFix(p, ndiff);
 								return;
             } else if (c->getBalance() == 0) {
@@ -587,7 +1678,7 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int8_t diff) {
                 c->setBalance(1);
 								return;
             } else {
-                AVLNode<Key, Value>* g = c->getRight();
+                AVLNode<Key, Value, Augment>* g = c->getRight();
                 rotateLeft(c);
                 rotateRight(n);
 
@@ -618,7 +1709,7 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int8_t diff) {
         }
     } else if (diff == 1) {
         if (n->getBalance() + diff == 2) {
-            AVLNode<Key, Value>* c = n->getRight();
+            AVLNode<Key, Value, Augment>* c = n->getRight();
 
             if (c->getBalance() == 1) {
                 rotateLeft(n);
@@ -632,7 +1723,7 @@ void AVLTree<Key, Value>::removeFix(AVLNode<Key, Value>* n, int8_t diff) {
                 c->setBalance(-1);
 								return;
             } else {
-                AVLNode<Key, Value>* g = c->getLeft();
+                AVLNode<Key, Value, Augment>* g = c->getLeft();
                 rotateRight(c);
                 rotateLeft(n);
 
@@ -1,48 +1,2191 @@
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <cstdint>
+#include <iterator>
 #include <map>
+#include <memory>
+#include <stdexcept>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #include "bst.h"
 #include "avlbst.h"
+#include "concurrent-avl.h"
+#include "persistent-avl.h"
+#include "thread-pool.h"
+
+#include <gtest/gtest.h>
 
 using namespace std;
 
+/**
+ * An AVLTree on ints that exposes its root, so tests can check the stored
+ * balances against the real subtree heights.
+ */
+class OpenAVLTree : public AVLTree<int, int>
+{
+public:
+    AVLNode<int, int>* root() { return static_cast<AVLNode<int, int>*>(this->root_); }
+};
 
-int main(int argc, char *argv[])
+/**
+ * A plain BinarySearchTree on ints that exposes its root.
+ */
+template<class Alloc = NewNodeAllocator>
+class OpenBST : public BinarySearchTree<int, int, Alloc>
 {
-    // Binary Search Tree tests
-    BinarySearchTree<char,int> bt;
-    bt.insert(std::make_pair('a',1));
-    bt.insert(std::make_pair('b',2));
-    
-    cout << "Binary Search Tree contents:" << endl;
-    for(BinarySearchTree<char,int>::iterator it = bt.begin(); it != bt.end(); ++it) {
-        cout << it->first << " " << it->second << endl;
+public:
+    Node<int, int>* root() { return this->root_; }
+
+    // Throws off the count of unbalanced nodes behind isBalanced
+    void corruptBalanceCount() { ++this->unbalanced_; }
+
+    // Replaces the contents with keys 0 to n - 1 in one right-leaning
+    // chain, the shape sorted inserts give, without the O(n^2) inserts
+    void makeChain(int n)
+    {
+        this->clear();
+        Node<int, int>* last = NULL;
+        for(int i = 0; i < n; ++i) {
+            auto source = itemFrom<int, int>([i]() { return make_pair(i, i); });
+            Node<int, int>* node = this->createNode(source);
+            node->setParent(last);
+            if(last == NULL) {
+                this->root_ = node;
+            }
+            else {
+                last->setRight(node);
+            }
+            last = node;
+        }
     }
-    if(bt.find('b') != bt.end()) {
-        cout << "Found b" << endl;
+};
+
+// Returns the height of node's subtree, flagging every stored balance that
+// does not match it or is out of the AVL range
+int checkBalances(AVLNode<int, int>* node)
+{
+    if(node == NULL) {
+        return 0;
     }
-    else {
-        cout << "Did not find b" << endl;
+    int left = checkBalances(node->getLeft());
+    int right = checkBalances(node->getRight());
+    EXPECT_EQ(node->getBalance(), right - left) << "at key " << node->getKey();
+    EXPECT_LE(abs(right - left), 1) << "at key " << node->getKey();
+    return 1 + max(left, right);
+}
+
+// Copies node's subtree into items, checking that the keys come out in order
+void collect(Node<int, int>* node, map<int, int>& items)
+{
+    if(node != NULL) {
+        collect(node->getLeft(), items);
+        EXPECT_TRUE(items.empty() || items.rbegin()->first < node->getKey());
+        items[node->getKey()] = node->getValue();
+        collect(node->getRight(), items);
     }
-    cout << "Erasing b" << endl;
+}
+
+TEST(BSTSmoke, InsertFindRemove)
+{
+    BinarySearchTree<char,int> bt;
+    bt.insert(std::make_pair('a',1));
+    bt.insert(std::make_pair('b',2));
+
+    ASSERT_NE(bt.find('a'), bt.end());
+    EXPECT_EQ(bt.find('a')->second, 1);
+    ASSERT_NE(bt.find('b'), bt.end());
+    EXPECT_EQ(bt.find('b')->second, 2);
     bt.remove('b');
+    EXPECT_EQ(bt.find('b'), bt.end());
+}
 
-    // AVL Tree Tests
+TEST(AVLSmoke, InsertFindRemove)
+{
     AVLTree<char,int> at;
     at.insert(std::make_pair('a',1));
     at.insert(std::make_pair('b',2));
 
-    cout << "\nAVLTree contents:" << endl;
-    for(AVLTree<char,int>::iterator it = at.begin(); it != at.end(); ++it) {
-        cout << it->first << " " << it->second << endl;
+    ASSERT_NE(at.find('a'), at.end());
+    EXPECT_EQ(at.find('a')->second, 1);
+    ASSERT_NE(at.find('b'), at.end());
+    EXPECT_EQ(at.find('b')->second, 2);
+    at.remove('b');
+    EXPECT_EQ(at.find('b'), at.end());
+}
+
+TEST(AVLInsert, ZigZagBalances)
+{
+    // Each triple forces one of the four rotation cases at the root
+    const int cases[4][3] = { {3, 2, 1}, {1, 2, 3}, {3, 1, 2}, {1, 3, 2} };
+    for(int c = 0; c < 4; ++c) {
+        OpenAVLTree tree;
+        for(int i = 0; i < 3; ++i) {
+            tree.insert(make_pair(cases[c][i], i));
+        }
+        EXPECT_EQ(tree.root()->getKey(), 2);
+        EXPECT_EQ(checkBalances(tree.root()), 2);
     }
-    if(at.find('b') != at.end()) {
-        cout << "Found b" << endl;
+
+    // Double rotations below the root, where the pivot already leans
+    for(int lean = -1; lean <= 1; lean += 2) {
+        OpenAVLTree tree;
+        const int keys[] = { 50, 20, 80, 10, 30, 90, 25, 35 };
+        for(size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+            tree.insert(make_pair(keys[i], 0));
+        }
+        tree.insert(make_pair(lean < 0 ? 24 : 36, 0));
+        checkBalances(tree.root());
     }
-    else {
-        cout << "Did not find b" << endl;
+}
+
+TEST(AVLInsert, BalancesMatchHeights)
+{
+    mt19937 rng(1);
+    for(int round = 0; round < 50; ++round) {
+        OpenAVLTree tree;
+        map<int, int> ref;
+        int n = rng() % 1000;
+        int range = 1 + rng() % 2000;
+        for(int i = 0; i < n; ++i) {
+            // Some runs ascend or descend, the rest are random with repeats
+            int k = round % 5 == 0 ? i : round % 5 == 1 ? n - i : int(rng() % range);
+            tree.insert(make_pair(k, i));
+            ref[k] = i;
+        }
+        checkBalances(tree.root());
+        map<int, int> contents;
+        collect(tree.root(), contents);
+        EXPECT_EQ(contents, ref);
     }
-    cout << "Erasing b" << endl;
-    at.remove('b');
+}
+
+TEST(AVLInsert, SortedInputStaysLogarithmic)
+{
+    // 2^16 - 1 ascending keys come out as a perfect tree
+    OpenAVLTree tree;
+    for(int i = 0; i < (1 << 16) - 1; ++i) {
+        tree.insert(make_pair(i, i));
+    }
+    EXPECT_EQ(checkBalances(tree.root()), 16);
+}
+
+/**
+ * A trace hook that records each event as a line of text.
+ */
+struct RecordingTrace
+{
+    vector<string> events;
+
+    template<typename NodeT> void onRotateLeft(const NodeT* x)
+    {
+        events.push_back("rotateLeft " + to_string(x->getKey()));
+    }
+    template<typename NodeT> void onRotateRight(const NodeT* z)
+    {
+        events.push_back("rotateRight " + to_string(z->getKey()));
+    }
+    template<typename NodeT> void onNodeSwap(const NodeT* n1, const NodeT* n2)
+    {
+        events.push_back("nodeSwap " + to_string(n1->getKey()) + " " + to_string(n2->getKey()));
+    }
+    template<typename KeyT> void onRemoveNotFound(const KeyT& key)
+    {
+        events.push_back("notFound " + to_string(key));
+    }
+};
+
+TEST(AVLTrace, ReportsEvents)
+{
+    AVLTree<int, int, RecordingTrace> tree;
+    tree.insert(make_pair(1, 1));
+    tree.insert(make_pair(2, 2));
+    tree.insert(make_pair(3, 3));
+    tree.insert(make_pair(0, 0));
+    EXPECT_EQ(tree.getTrace().events, vector<string>{ "rotateLeft 1" });
+
+    // 2 has two children, so it trades places with its predecessor 1
+    tree.getTrace().events.clear();
+    tree.remove(2);
+    tree.remove(7);
+    EXPECT_EQ(tree.getTrace().events, (vector<string>{ "nodeSwap 1 2", "notFound 7" }));
+    EXPECT_EQ(tree.find(2), tree.end());
+    EXPECT_NE(tree.find(1), tree.end());
+}
+
+TEST(AVLTrace, RemoveIsSilentByDefault)
+{
+    AVLTree<int, int> tree;
+    testing::internal::CaptureStdout();
+    for(int i = 0; i < 100; ++i) {
+        tree.insert(make_pair(i, i));
+    }
+    for(int i = 0; i < 120; i += 2) {
+        tree.remove(i);
+    }
+    EXPECT_EQ(testing::internal::GetCapturedStdout(), "");
+}
+
+TEST(AVLTrace, StreamTraceWritesLines)
+{
+    ostringstream out;
+    AVLTree<int, int, StreamTrace> tree;
+    tree.getTrace() = StreamTrace(out);
+    tree.insert(make_pair(3, 3));
+    tree.insert(make_pair(2, 2));
+    tree.insert(make_pair(1, 1));
+    tree.remove(9);
+    EXPECT_EQ(out.str(), "rotateRight 3\nremove not found 9\n");
+}
+
+TEST(AVLRemove, BalancesMatchHeights)
+{
+    mt19937 rng(2);
+    for(int round = 0; round < 50; ++round) {
+        OpenAVLTree tree;
+        map<int, int> ref;
+        int range = 1 + rng() % 500;
+        for(int op = 0; op < 2000; ++op) {
+            int k = rng() % range;
+            if(rng() % 2) {
+                tree.insert(make_pair(k, op));
+                ref[k] = op;
+            }
+            else {
+                tree.remove(k);
+                ref.erase(k);
+            }
+        }
+        checkBalances(tree.root());
+        map<int, int> contents;
+        collect(tree.root(), contents);
+        EXPECT_EQ(contents, ref);
+    }
+}
+
+struct Slot
+{
+    explicit Slot(int v) : value(v) {}
+    long value;
+};
+
+TEST(PoolNodeAllocator, ReusesDestroyedSlots)
+{
+    PoolNodeAllocator<4> pool;
+    vector<Slot*> slots;
+    for(int i = 0; i < 5; ++i) {
+        slots.push_back(pool.create<Slot>(i));
+        EXPECT_EQ(slots.back()->value, i);
+    }
+    EXPECT_EQ(pool.blockCount(), 2u);
+
+    // Freed slots come back before a new block is started
+    pool.destroy(slots[1]);
+    pool.destroy(slots[3]);
+    EXPECT_EQ(pool.create<Slot>(7), slots[3]);
+    EXPECT_EQ(pool.create<Slot>(8), slots[1]);
+    pool.create<Slot>(9);
+    pool.create<Slot>(10);
+    pool.create<Slot>(11);
+    EXPECT_EQ(pool.blockCount(), 2u);
+    pool.create<Slot>(12);
+    EXPECT_EQ(pool.blockCount(), 3u);
+
+    pool.release();
+    EXPECT_EQ(pool.blockCount(), 0u);
+}
+
+TEST(PoolNodeAllocator, RejectsLargerNodes)
+{
+    PoolNodeAllocator<> pool;
+    typedef pair<Slot, Slot> TwoSlots;
+    pool.create<Slot>(1);
+    EXPECT_THROW(pool.create<TwoSlots>(Slot(1), Slot(2)), logic_error);
+}
+
+TEST(PoolNodeAllocator, TreesMatchMapAndClearReleasesBlocks)
+{
+    typedef AVLTree<int, int, NoTrace, PoolNodeAllocator<64> > PooledAVL;
+    mt19937 rng(3);
+    PooledAVL tree;
+    BinarySearchTree<int, int, PoolNodeAllocator<64> > plain;
+    map<int, int> ref;
+    for(int op = 0; op < 20000; ++op) {
+        int k = rng() % 1000;
+        if(rng() % 3) {
+            tree.insert(make_pair(k, op));
+            plain.insert(make_pair(k, op));
+            ref[k] = op;
+        }
+        else {
+            tree.remove(k);
+            plain.remove(k);
+            ref.erase(k);
+        }
+    }
+    for(int k = 0; k < 1000; ++k) {
+        bool present = ref.count(k) == 1;
+        ASSERT_EQ(tree.find(k) != tree.end(), present);
+        ASSERT_EQ(plain.find(k) != plain.end(), present);
+        if(present) {
+            EXPECT_EQ(tree.find(k)->second, ref[k]);
+            EXPECT_EQ(plain.find(k)->second, ref[k]);
+        }
+    }
+    // Removed nodes are recycled, so the pool never holds more than the peak
+    EXPECT_LE(tree.getAllocator().blockCount(), 1000u / 64 + 1);
+
+    tree.clear();
+    plain.clear();
+    EXPECT_EQ(tree.getAllocator().blockCount(), 0u);
+    EXPECT_EQ(plain.getAllocator().blockCount(), 0u);
+    tree.insert(make_pair(1, 1));
+    EXPECT_EQ(tree.find(1)->second, 1);
+}
+
+TEST(NodeLayout, NoVtableAndPackedBalance)
+{
+    EXPECT_FALSE((is_polymorphic<Node<uint64_t, uint64_t> >::value));
+    EXPECT_FALSE((is_polymorphic<AVLNode<uint64_t, uint64_t> >::value));
+    if(sizeof(void*) == 8) {
+        // Three pointers and a 16-byte item; the balance costs nothing
+        EXPECT_EQ(sizeof(AVLNode<uint64_t, uint64_t>), 40u);
+        EXPECT_EQ(sizeof(AVLNode<int, int>), 32u);
+    }
+    EXPECT_EQ(sizeof(AVLNode<uint64_t, uint64_t>), sizeof(Node<uint64_t, uint64_t>));
+}
+
+TEST(NodeLayout, BalanceAndParentShareAWord)
+{
+    AVLNode<int, int> parent(1, 1, NULL);
+    AVLNode<int, int> child(2, 2, &parent);
+    for(int balance = -2; balance <= 2; ++balance) {
+        child.setBalance(balance);
+        EXPECT_EQ(child.getBalance(), balance);
+        EXPECT_EQ(child.getParent(), &parent);
+    }
+    child.setBalance(-1);
+    child.setParent(NULL);
+    EXPECT_EQ(child.getBalance(), -1);
+    child.setParent(&parent);
+    EXPECT_EQ(child.getParent(), &parent);
+    EXPECT_EQ(child.getBalance(), -1);
+    child.updateBalance(2);
+    EXPECT_EQ(child.getBalance(), 1);
+}
+
+TEST(NodeLayout, DeleteThroughBaseUsesDerivedNodes)
+{
+    // With no virtual destructor on Node, AVLTree must free its own nodes
+    BinarySearchTree<int, int>* tree = new AVLTree<int, int>();
+    for(int i = 0; i < 1000; ++i) {
+        tree->insert(make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        tree->remove(i);
+    }
+    EXPECT_TRUE(tree->isBalanced());
+    delete tree;
+}
+
+// Returns the height of node's subtree
+int heightOf(Node<int, int>* node)
+{
+    return node == NULL ? 0 : 1 + max(heightOf(node->getLeft()), heightOf(node->getRight()));
+}
+
+TEST(BulkLoad, SortedInput)
+{
+    for(int n = 0; n < 300; n += 7) {
+        vector<pair<int, int> > items;
+        map<int, int> ref;
+        for(int i = 0; i < n; ++i) {
+            items.push_back(make_pair(2 * i, i));
+            ref[2 * i] = i;
+        }
+        OpenAVLTree avl;
+        avl.bulkLoad(items.begin(), items.end());
+        int height = checkBalances(avl.root());
+        map<int, int> contents;
+        collect(avl.root(), contents);
+        EXPECT_EQ(contents, ref);
+
+        // Perfectly balanced: no taller than a complete tree of n nodes
+        int minHeight = 0;
+        while((1 << minHeight) - 1 < n) {
+            ++minHeight;
+        }
+        EXPECT_EQ(height, minHeight);
+
+        OpenBST<> bst;
+        bst.bulkLoad(items.begin(), items.end());
+        EXPECT_EQ(heightOf(bst.root()), minHeight);
+        contents.clear();
+        collect(bst.root(), contents);
+        EXPECT_EQ(contents, ref);
+        EXPECT_TRUE(bst.isBalanced());
+    }
+}
+
+TEST(BulkLoad, UnsortedInputWithDuplicates)
+{
+    mt19937 rng(4);
+    for(int round = 0; round < 50; ++round) {
+        vector<pair<int, int> > items;
+        map<int, int> ref;
+        int n = rng() % 500;
+        for(int i = 0; i < n; ++i) {
+            // The last value given for a key wins, as with repeated insert
+            int k = rng() % 200;
+            items.push_back(make_pair(k, i));
+            ref[k] = i;
+        }
+        OpenAVLTree avl;
+        avl.insert(make_pair(-1, -1));
+        avl.bulkLoad(items.begin(), items.end());
+        checkBalances(avl.root());
+        map<int, int> contents;
+        collect(avl.root(), contents);
+        EXPECT_EQ(contents, ref);
+
+        OpenBST<> bst;
+        bst.bulkLoad(items.begin(), items.end());
+        contents.clear();
+        collect(bst.root(), contents);
+        EXPECT_EQ(contents, ref);
+        EXPECT_TRUE(bst.isBalanced());
+    }
+}
+
+TEST(BulkLoad, RangeConstructors)
+{
+    vector<pair<int, int> > items;
+    for(int i = 0; i < 100; ++i) {
+        items.push_back(make_pair(i, -i));
+    }
+    AVLTree<int, int> avl(items.begin(), items.end());
+    BinarySearchTree<int, int> bst(items.begin(), items.end());
+    for(int i = 0; i < 100; ++i) {
+        ASSERT_NE(avl.find(i), avl.end());
+        EXPECT_EQ(avl.find(i)->second, -i);
+        ASSERT_NE(bst.find(i), bst.end());
+        EXPECT_EQ(bst.find(i)->second, -i);
+    }
+    EXPECT_TRUE(avl.isBalanced());
+    EXPECT_TRUE(bst.isBalanced());
+}
+
+TEST(BulkLoad, ThroughBaseReferenceBuildsAVLNodes)
+{
+    vector<pair<int, int> > items;
+    for(int i = 0; i < 1000; ++i) {
+        items.push_back(make_pair(i, i));
+    }
+    OpenAVLTree avl;
+    BinarySearchTree<int, int>& base = avl;
+    base.bulkLoad(items.begin(), items.end());
+    checkBalances(avl.root());
+
+    // The stored balances must be right for later inserts and removes
+    for(int i = 0; i < 1000; i += 2) {
+        avl.remove(i);
+        avl.insert(make_pair(1000 + i, i));
+    }
+    checkBalances(avl.root());
+}
+
+TEST(Clear, DeepChainDoesNotRecurse)
+{
+    OpenBST<> tree;
+    tree.makeChain(1000000);
+    tree.clear();
+    EXPECT_TRUE(tree.empty());
+    tree.insert(make_pair(1, 1));
+    EXPECT_EQ(tree.find(1)->second, 1);
+
+    // The destructor goes through clear as well
+    OpenBST<PoolNodeAllocator<> > pooled;
+    pooled.makeChain(1000000);
+}
+
+/**
+ * A value that counts how many of its kind are alive.
+ */
+struct Counted
+{
+    Counted() { ++live; }
+    Counted(const Counted&) { ++live; }
+    ~Counted() { --live; }
+
+    static int live;
+};
+
+int Counted::live = 0;
+
+// The trees' print instantiates this
+ostream& operator<<(ostream& out, const Counted&)
+{
+    return out << "Counted";
+}
+
+TEST(Clear, RunsDestructorsUnlessTrivial)
+{
+    {
+        BinarySearchTree<int, Counted, PoolNodeAllocator<> > plain;
+        AVLTree<int, Counted, NoTrace, PoolNodeAllocator<> > avl;
+        for(int i = 0; i < 1000; ++i) {
+            plain.insert(make_pair(i * 7 % 1000, Counted()));
+            avl.insert(make_pair(i, Counted()));
+        }
+        EXPECT_EQ(Counted::live, 2000);
+        plain.clear();
+        EXPECT_EQ(Counted::live, 1000);
+        EXPECT_EQ(plain.getAllocator().blockCount(), 0u);
+        avl.remove(5);
+        EXPECT_EQ(Counted::live, 999);
+    }
+    EXPECT_EQ(Counted::live, 0);
+
+    // Pooled ints skip the walk and just drop the blocks
+    AVLTree<int, int, NoTrace, PoolNodeAllocator<> > ints;
+    for(int i = 0; i < 10000; ++i) {
+        ints.insert(make_pair(i, i));
+    }
+    ints.clear();
+    EXPECT_TRUE(ints.empty());
+    EXPECT_EQ(ints.getAllocator().blockCount(), 0u);
+}
+
+// Checks tree holds exactly ref, walking forwards, backwards and in reverse
+template<typename Tree, typename Map>
+void expectSameOrder(const Tree& tree, const Map& ref)
+{
+    ASSERT_EQ(distance(tree.begin(), tree.end()), static_cast<ptrdiff_t>(ref.size()));
+    EXPECT_TRUE(equal(tree.begin(), tree.end(), ref.begin()));
+    EXPECT_TRUE(equal(tree.rbegin(), tree.rend(), ref.rbegin()));
+    EXPECT_TRUE(equal(tree.cbegin(), tree.cend(), ref.begin()));
+    EXPECT_TRUE(equal(tree.crbegin(), tree.crend(), ref.rbegin()));
+
+    typename Map::const_reverse_iterator expected = ref.rbegin();
+    typename Tree::iterator it = tree.end();
+    while(it != tree.begin()) {
+        --it;
+        ASSERT_NE(expected, ref.rend());
+        EXPECT_EQ(it->first, expected->first);
+        EXPECT_EQ((*it).second, expected->second);
+        ++expected;
+    }
+    EXPECT_EQ(expected, ref.rend());
+}
+
+TEST(Iterators, MatchMapBothWays)
+{
+    mt19937 rng(7);
+    for(int round = 0; round < 30; ++round) {
+        AVLTree<int, int> avl;
+        BinarySearchTree<int, int> bst;
+        map<int, int> ref;
+        int n = rng() % 500;
+        for(int i = 0; i < n; ++i) {
+            int k = rng() % 1000;
+            avl.insert(make_pair(k, i));
+            bst.insert(make_pair(k, i));
+            ref[k] = i;
+            if(i % 4 == 0) {
+                avl.remove(k / 2);
+                bst.remove(k / 2);
+                ref.erase(k / 2);
+            }
+        }
+        expectSameOrder(avl, ref);
+        expectSameOrder(bst, ref);
+    }
+}
+
+TEST(Iterators, StepsAndEnds)
+{
+    AVLTree<int, int> tree;
+    EXPECT_EQ(tree.begin(), tree.end());
+    EXPECT_THROW(--tree.end(), out_of_range);
+    EXPECT_THROW(++tree.end(), out_of_range);
+
+    for(int i = 1; i <= 3; ++i) {
+        tree.insert(make_pair(i, i * 10));
+    }
+    AVLTree<int, int>::iterator it = tree.begin();
+    EXPECT_EQ((it++)->first, 1);
+    EXPECT_EQ(it->first, 2);
+    EXPECT_EQ((it--)->first, 2);
+    EXPECT_EQ(it->first, 1);
+    EXPECT_EQ((--tree.end())->first, 3);
+    EXPECT_EQ(tree.rbegin()->first, 3);
+
+    // Values can be written through an iterator; keys cannot
+    it->second = 11;
+    EXPECT_EQ(tree.find(1)->second, 11);
+
+    int sum = 0;
+    for(const pair<const int, int>& item : tree) {
+        sum += item.first;
+    }
+    EXPECT_EQ(sum, 6);
+    EXPECT_EQ(count_if(tree.begin(), tree.end(),
+                       [](const pair<const int, int>& item) { return item.second >= 20; }), 2);
+}
+
+TEST(Iterators, TypesAndConversions)
+{
+    typedef BinarySearchTree<int, int> Tree;
+    EXPECT_TRUE((is_same<iterator_traits<Tree::iterator>::iterator_category,
+                         bidirectional_iterator_tag>::value));
+    EXPECT_TRUE((is_same<iterator_traits<Tree::const_iterator>::reference,
+                         const pair<const int, int>&>::value));
+    EXPECT_TRUE((is_convertible<Tree::iterator, Tree::const_iterator>::value));
+    EXPECT_FALSE((is_convertible<Tree::const_iterator, Tree::iterator>::value));
+    EXPECT_TRUE((is_copy_assignable<Tree::iterator>::value));
+    EXPECT_TRUE((is_copy_assignable<Tree::const_iterator>::value));
+
+    Tree tree;
+    tree.insert(make_pair(1, 1));
+    Tree::const_iterator cit = tree.begin();
+    EXPECT_EQ(cit->first, 1);
+    cit = tree.cend();
+    EXPECT_EQ(cit, tree.cend());
+}
+
+// The key an iterator points at, or -1 at the end
+template<typename It, typename End>
+int keyAt(It it, End end)
+{
+    return it == end ? -1 : it->first;
+}
+
+TEST(RangeQueries, BoundsMatchMap)
+{
+    mt19937 rng(8);
+    for(int round = 0; round < 30; ++round) {
+        AVLTree<int, int> avl;
+        BinarySearchTree<int, int> bst;
+        map<int, int> ref;
+        for(int i = 0; i < int(rng() % 300); ++i) {
+            int k = 2 * (rng() % 300);
+            avl.insert(make_pair(k, i));
+            bst.insert(make_pair(k, i));
+            ref[k] = i;
+        }
+        for(int k = -2; k <= 602; ++k) {
+            int lower = keyAt(ref.lower_bound(k), ref.end());
+            int upper = keyAt(ref.upper_bound(k), ref.end());
+            EXPECT_EQ(keyAt(avl.lower_bound(k), avl.end()), lower);
+            EXPECT_EQ(keyAt(avl.upper_bound(k), avl.end()), upper);
+            EXPECT_EQ(keyAt(bst.lower_bound(k), bst.end()), lower);
+            EXPECT_EQ(keyAt(bst.upper_bound(k), bst.end()), upper);
+
+            pair<AVLTree<int, int>::iterator, AVLTree<int, int>::iterator> range = avl.equal_range(k);
+            EXPECT_EQ(keyAt(range.first, avl.end()), lower);
+            EXPECT_EQ(keyAt(range.second, avl.end()), upper);
+            EXPECT_EQ(distance(range.first, range.second), static_cast<ptrdiff_t>(ref.count(k)));
+        }
+    }
+}
+
+TEST(RangeQueries, ForEachInRangeIsInclusive)
+{
+    mt19937 rng(9);
+    AVLTree<int, int> tree;
+    map<int, int> ref;
+    for(int i = 0; i < 2000; ++i) {
+        int k = rng() % 5000;
+        tree.insert(make_pair(k, i));
+        ref[k] = i;
+    }
+    for(int round = 0; round < 200; ++round) {
+        int lo = int(rng() % 5200) - 100;
+        int hi = lo + int(rng() % 300) - 20;
+        vector<pair<int, int> > seen;
+        tree.forEachInRange(lo, hi, [&seen](const pair<const int, int>& item) {
+            seen.push_back(item);
+        });
+        vector<pair<int, int> > expected;
+        if(lo <= hi) {
+            expected.assign(ref.lower_bound(lo), ref.upper_bound(hi));
+        }
+        EXPECT_EQ(seen, expected);
+    }
+}
+
+typedef AVLTree<int, int, NoTrace, NewNodeAllocator, SubtreeSize> RankedTree;
+
+// Checks size, rank, select and countInRange of tree against ref
+void expectOrderStatistics(const RankedTree& tree, const map<int, int>& ref)
+{
+    ASSERT_EQ(tree.size(), ref.size());
+    size_t i = 0;
+    for(map<int, int>::const_iterator it = ref.begin(); it != ref.end(); ++it, ++i) {
+        RankedTree::iterator found = tree.select(i);
+        ASSERT_TRUE(found != tree.end());
+        EXPECT_EQ(found->first, it->first);
+        EXPECT_EQ(tree.rank(it->first), i);
+        EXPECT_EQ(tree.rank(it->first + 1), i + 1);
+    }
+    EXPECT_TRUE(tree.select(ref.size()) == tree.end());
+    EXPECT_EQ(tree.rank(-1), 0u);
+}
+
+TEST(OrderStatistics, MatchMapThroughInsertAndRemove)
+{
+    mt19937 rng(10);
+    RankedTree tree;
+    map<int, int> ref;
+    EXPECT_EQ(tree.size(), 0u);
+    EXPECT_TRUE(tree.select(0) == tree.end());
+    for(int i = 0; i < 3000; ++i) {
+        int k = 2 * (rng() % 1000);
+        if(rng() % 3 == 0) {
+            tree.remove(k);
+            ref.erase(k);
+        }
+        else {
+            tree.insert(make_pair(k, i));
+            ref[k] = i;
+        }
+        if(i % 250 == 0) {
+            expectOrderStatistics(tree, ref);
+        }
+    }
+    expectOrderStatistics(tree, ref);
+
+    for(int round = 0; round < 200; ++round) {
+        int lo = int(rng() % 2100) - 50;
+        int hi = lo + int(rng() % 400) - 50;
+        size_t expected = 0;
+        if(lo <= hi) {
+            expected = distance(ref.lower_bound(lo), ref.upper_bound(hi));
+        }
+        EXPECT_EQ(tree.countInRange(lo, hi), expected);
+    }
+}
+
+TEST(OrderStatistics, BulkLoadSetsSubtreeSizes)
+{
+    vector<pair<int, int> > items;
+    map<int, int> ref;
+    for(int i = 0; i < 777; ++i) {
+        items.push_back(make_pair(3 * i, i));
+        ref[3 * i] = i;
+    }
+    RankedTree tree(items.begin(), items.end());
+    expectOrderStatistics(tree, ref);
+
+    tree.insert(make_pair(1, 1));
+    tree.remove(300);
+    ref[1] = 1;
+    ref.erase(300);
+    expectOrderStatistics(tree, ref);
+}
+
+/**
+ * A string key that counts how many times one is built from a C string,
+ * and compares directly against C strings.
+ */
+struct Name
+{
+    Name(const char* s) : text(s) { ++made; }
+
+    string text;
+    static int made;
+};
+
+int Name::made = 0;
+
+bool operator<(const Name& a, const Name& b) { return a.text < b.text; }
+bool operator<(const Name& a, const char* b) { return a.text < b; }
+bool operator<(const char* a, const Name& b) { return a < b.text; }
+bool operator>(const Name& a, const Name& b) { return b < a; }
+
+ostream& operator<<(ostream& out, const Name& name)
+{
+    return out << name.text;
+}
+
+/**
+ * A transparent less-than, like C++14's std::less<>.
+ */
+struct TransparentLess
+{
+    typedef void is_transparent;
+
+    template<typename A, typename B>
+    bool operator()(const A& a, const B& b) const
+    {
+        return a < b;
+    }
+};
+
+TEST(HeterogeneousLookup, TransparentComparatorBuildsNoKeys)
+{
+    static_assert(HeterogeneousKey<Name, TransparentLess, const char*>::value, "C strings probe Names");
+    static_assert(!HeterogeneousKey<Name, TransparentLess, Name>::value, "Name probes use the Key overloads");
+    static_assert(!HeterogeneousKey<Name, less<Name>, const char*>::value,
+                  "the default comparator converts probes");
+
+    AVLTree<Name, int, NoTrace, NewNodeAllocator, NoAugment, TransparentLess > avl;
+    BinarySearchTree<Name, int, NewNodeAllocator, TransparentLess > bst;
+    const char* names[] = { "kiwi", "apple", "fig", "pear", "date", "lime" };
+    for(int i = 0; i < 6; ++i) {
+        avl.insert(make_pair(Name(names[i]), i));
+        bst.insert(make_pair(Name(names[i]), i));
+    }
+
+    int before = Name::made;
+    EXPECT_EQ(avl.find("fig")->second, 2);
+    EXPECT_TRUE(avl.find("plum") == avl.end());
+    EXPECT_EQ(avl.lower_bound("g")->first.text, "kiwi");
+    EXPECT_EQ(avl.upper_bound("kiwi")->first.text, "lime");
+    EXPECT_EQ(avl["pear"], 3);
+    EXPECT_THROW(avl["plum"], out_of_range);
+    EXPECT_EQ(bst.find("date")->second, 4);
+    EXPECT_EQ(bst.lower_bound("b")->first.text, "date");
+    avl.remove("apple");
+    avl.remove("plum");
+    bst.remove("apple");
+    EXPECT_EQ(Name::made, before);
+
+    EXPECT_TRUE(avl.find("apple") == avl.end());
+    EXPECT_TRUE(bst.find("apple") == bst.end());
+    EXPECT_EQ(avl.begin()->first.text, "date");
+    EXPECT_EQ(bst.begin()->first.text, "date");
+}
+
+TEST(HeterogeneousLookup, ScalarProbesConvertToKey)
+{
+    AVLTree<int, int> ints;
+    ints.insert(make_pair(2, 20));
+    EXPECT_EQ(ints.find(2.5)->second, 20);
+
+    BinarySearchTree<unsigned char, int> bytes;
+    bytes.insert(make_pair(static_cast<unsigned char>(4), 40));
+    int probe = 260;
+    EXPECT_EQ(bytes.find(probe)->second, 40);
+
+    AVLTree<Name, int> names;
+    names.insert(make_pair(Name("fig"), 1));
+    int before = Name::made;
+    EXPECT_EQ(names.find("fig")->second, 1);
+    EXPECT_EQ(Name::made, before + 1);
+}
+
+/**
+ * Orders ints by a less-than and counts how often it is asked.
+ */
+struct CountingLess
+{
+    bool operator()(int a, int b) const
+    {
+        ++calls;
+        return a < b;
+    }
+
+    static long calls;
+};
+
+long CountingLess::calls = 0;
+
+TEST(Comparator, GreaterReversesOrder)
+{
+    AVLTree<int, int, NoTrace, NewNodeAllocator, NoAugment, greater<int> > avl;
+    BinarySearchTree<int, int, NewNodeAllocator, greater<int> > bst;
+    map<int, int, greater<int> > ref;
+    mt19937 rng(11);
+    for(int i = 0; i < 2000; ++i) {
+        int k = rng() % 1000;
+        if(rng() % 4 == 0) {
+            avl.remove(k);
+            bst.remove(k);
+            ref.erase(k);
+        }
+        else {
+            avl.insert(make_pair(k, i));
+            bst.insert(make_pair(k, i));
+            ref[k] = i;
+        }
+    }
+    expectSameOrder(avl, ref);
+    expectSameOrder(bst, ref);
+    EXPECT_EQ(avl.lower_bound(500)->first, ref.lower_bound(500)->first);
+    EXPECT_EQ(bst.upper_bound(500)->first, ref.upper_bound(500)->first);
+}
+
+TEST(Comparator, OneComparisonPerLevel)
+{
+    const int n = 1 << 14;
+    AVLTree<int, int, NoTrace, NewNodeAllocator, NoAugment, CountingLess> tree;
+    for(int i = 0; i < n; ++i) {
+        tree.insert(make_pair((i * 7919) % n, i));
+    }
+
+    // A balanced tree of n nodes is at most 1.44 lg n deep; each descent
+    // asks once per level plus once at the bottom
+    const double lg = log2(double(n));
+    CountingLess::calls = 0;
+    for(int i = 0; i < n; ++i) {
+        ASSERT_TRUE(tree.find(i) != tree.end());
+    }
+    EXPECT_LE(CountingLess::calls, long(n * (1.45 * lg + 2)));
+
+    CountingLess::calls = 0;
+    for(int i = 0; i < n; ++i) {
+        tree.insert(make_pair(i, -i));
+    }
+    EXPECT_LE(CountingLess::calls, long(n * (1.45 * lg + 2)));
+    EXPECT_EQ(tree[5], -5);
+}
+
+/**
+ * An int wrapper that counts its copies and moves.
+ */
+struct Tracked
+{
+    explicit Tracked(int v = 0) : value(v) {}
+    Tracked(const Tracked& other) : value(other.value) { ++copies; }
+    Tracked(Tracked&& other) : value(other.value) { ++moves; }
+    Tracked& operator=(const Tracked& other) { value = other.value; ++copies; return *this; }
+    Tracked& operator=(Tracked&& other) { value = other.value; ++moves; return *this; }
+
+    int value;
+    static int copies;
+    static int moves;
+};
+
+int Tracked::copies = 0;
+int Tracked::moves = 0;
+
+bool operator<(const Tracked& a, const Tracked& b) { return a.value < b.value; }
+bool operator>(const Tracked& a, const Tracked& b) { return b < a; }
+
+ostream& operator<<(ostream& out, const Tracked& t)
+{
+    return out << t.value;
+}
+
+template<typename Tree>
+void expectNoCopiesOnInsert()
+{
+    Tree tree;
+    Tracked::copies = Tracked::moves = 0;
+    for(int i = 0; i < 100; ++i) {
+        int k = (i * 37) % 100;
+        EXPECT_TRUE(tree.emplace(piecewise_construct, forward_as_tuple(k), forward_as_tuple(i)).second);
+    }
+    EXPECT_FALSE(tree.try_emplace(Tracked(5), 0).second);
+    EXPECT_TRUE(tree.try_emplace(Tracked(100), 100).second);
+    EXPECT_EQ(Tracked::copies, 0);
+
+    // try_emplace on a present key leaves both the key and the value alone
+    Tracked key(7);
+    Tracked::moves = 0;
+    EXPECT_FALSE(tree.try_emplace(std::move(key), 1).second);
+    EXPECT_EQ(Tracked::moves, 0);
+
+    // emplace builds the item first and drops it if the key is present
+    pair<typename Tree::iterator, bool> dup = tree.emplace(piecewise_construct,
+        forward_as_tuple(9), forward_as_tuple(-1));
+    EXPECT_FALSE(dup.second);
+    EXPECT_EQ(dup.first->second.value, (9 * 73) % 100);
+
+    pair<typename Tree::iterator, bool> res = tree.insert_or_assign(Tracked(9), Tracked(-9));
+    EXPECT_FALSE(res.second);
+    EXPECT_EQ(res.first->second.value, -9);
+    res = tree.insert_or_assign(Tracked(200), Tracked(200));
+    EXPECT_TRUE(res.second);
+
+    tree.insert(make_pair(Tracked(201), Tracked(201)));
+    tree.insert(make_pair(Tracked(9), Tracked(90)));
+    EXPECT_EQ(Tracked::copies, 0);
+    EXPECT_EQ(tree.find(Tracked(9))->second.value, 90);
+
+    int expected = 0;
+    for(typename Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        EXPECT_EQ(it->first.value, expected);
+        expected = expected == 100 ? 200 : expected + 1;
+    }
+    EXPECT_EQ(expected, 202);
+}
+
+TEST(Emplace, NothingIsCopied)
+{
+    expectNoCopiesOnInsert<BinarySearchTree<Tracked, Tracked> >();
+    expectNoCopiesOnInsert<AVLTree<Tracked, Tracked> >();
+}
+
+TEST(Emplace, ThroughBaseReferenceBuildsAVLNodes)
+{
+    OpenAVLTree avl;
+    BinarySearchTree<int, int>& base = avl;
+    for(int i = 0; i < 500; ++i) {
+        base.emplace(i, i);
+        base.try_emplace(1000 - i, i);
+        base.insert_or_assign(i / 2, -i);
+        base.insert(make_pair(2000 + i, i));
+    }
+    checkBalances(avl.root());
+    EXPECT_LT(heightOf(avl.root()), 14);
+    EXPECT_EQ(avl[249], -499);
+    EXPECT_EQ(avl[499], 499);
+    EXPECT_EQ(avl[501], 499);
+}
+
+TEST(HintedInsert, MatchesMapForAnyHint)
+{
+    mt19937 rng(13);
+    AVLTree<int, int> avl;
+    BinarySearchTree<int, int> bst;
+    map<int, int> ref;
+    for(int i = 0; i < 3000; ++i) {
+        int k = rng() % 2000;
+        // Mix good hints (the key's successor), end() and arbitrary ones
+        int pick = rng() % 3;
+        int h = pick == 0 ? k : pick == 1 ? 1 << 20 : int(rng() % 2000);
+        AVLTree<int, int>::iterator avlHint = avl.lower_bound(h);
+        BinarySearchTree<int, int>::iterator bstHint = bst.lower_bound(h);
+
+        AVLTree<int, int>::iterator a = avl.insert(avlHint, make_pair(k, i));
+        BinarySearchTree<int, int>::iterator b = bst.insert(bstHint, make_pair(k, i));
+        ref[k] = i;
+        EXPECT_EQ(a->first, k);
+        EXPECT_EQ(a->second, i);
+        EXPECT_EQ(b->first, k);
+    }
+    expectSameOrder(avl, ref);
+    expectSameOrder(bst, ref);
+}
+
+TEST(HintedInsert, AppendAtEndSkipsTheDescent)
+{
+    const int n = 1 << 14;
+    AVLTree<int, int, NoTrace, NewNodeAllocator, NoAugment, CountingLess> tree;
+    CountingLess::calls = 0;
+    for(int i = 0; i < n; ++i) {
+        tree.insert(tree.end(), make_pair(i, i));
+    }
+    // One comparison with the largest key per append
+    EXPECT_LE(CountingLess::calls, long(n));
+    EXPECT_EQ((--tree.end())->first, n - 1);
+
+    // A plain insert of a new maximum still descends the whole tree
+    CountingLess::calls = 0;
+    tree.insert(make_pair(n, n));
+    EXPECT_GE(CountingLess::calls, 14);
+}
+
+TEST(HintedInsert, ThroughBaseReferenceBuildsAVLNodes)
+{
+    OpenAVLTree avl;
+    BinarySearchTree<int, int>& base = avl;
+    for(int i = 0; i < 1000; ++i) {
+        base.insert(base.end(), make_pair(i, i));
+        base.insert(base.find(0), make_pair(-i - 1, i));
+    }
+    checkBalances(avl.root());
+    EXPECT_LT(heightOf(avl.root()), 15);
+    EXPECT_EQ(avl.begin()->first, -1000);
+    EXPECT_EQ((--avl.end())->first, 999);
+}
+
+// Checks that tree's cached min and max are the nodes found by walking
+// down from root
+template<typename Tree>
+void expectCachedEnds(Tree& tree, Node<int, int>* root)
+{
+    if(root == NULL) {
+        EXPECT_TRUE(tree.min() == tree.end());
+        EXPECT_TRUE(tree.max() == tree.end());
+        EXPECT_TRUE(tree.begin() == tree.end());
+        return;
+    }
+    Node<int, int>* lo = root;
+    Node<int, int>* hi = root;
+    while(lo->getLeft() != NULL) {
+        lo = lo->getLeft();
+    }
+    while(hi->getRight() != NULL) {
+        hi = hi->getRight();
+    }
+    EXPECT_EQ(&*tree.min(), &lo->getItem());
+    EXPECT_EQ(&*tree.max(), &hi->getItem());
+    EXPECT_EQ(&*tree.begin(), &lo->getItem());
+    EXPECT_EQ(&*tree.rbegin(), &hi->getItem());
+}
+
+TEST(BoundaryCache, FollowsInsertsRemovesAndLoads)
+{
+    mt19937 rng(14);
+    OpenAVLTree avl;
+    OpenBST<> bst;
+    expectCachedEnds(avl, avl.root());
+    for(int i = 0; i < 4000; ++i) {
+        int k = rng() % 500;
+        if(rng() % 2 == 0) {
+            avl.remove(k);
+            bst.remove(k);
+        }
+        else {
+            avl.insert(make_pair(k, i));
+            bst.insert(make_pair(k, i));
+        }
+        expectCachedEnds(avl, avl.root());
+        expectCachedEnds(bst, bst.root());
+    }
+
+    vector<pair<int, int> > items;
+    for(int i = 0; i < 100; ++i) {
+        items.push_back(make_pair(100 - i, i));
+    }
+    avl.bulkLoad(items.begin(), items.end());
+    expectCachedEnds(avl, avl.root());
+    EXPECT_EQ(avl.min()->first, 1);
+    EXPECT_EQ(avl.max()->first, 100);
+
+    avl.clear();
+    expectCachedEnds(avl, avl.root());
+}
+
+TEST(BoundaryCache, RemovingTheMinimumsParent)
+{
+    // 2 has the leaf minimum 1 as its left child and two children, so
+    // removing it swaps it with 1 first
+    OpenAVLTree avl;
+    int keys[] = { 4, 2, 6, 1, 3, 5, 7 };
+    for(int k : keys) {
+        avl.insert(make_pair(k, k));
+    }
+    avl.remove(2);
+    expectCachedEnds(avl, avl.root());
+    EXPECT_EQ(avl.min()->first, 1);
+    avl.remove(1);
+    avl.remove(7);
+    expectCachedEnds(avl, avl.root());
+    EXPECT_EQ(avl.min()->first, 3);
+    EXPECT_EQ(avl.max()->first, 6);
+}
+
+TEST(PopAndErase, PopDrainsInOrder)
+{
+    mt19937 rng(15);
+    AVLTree<int, int> avl;
+    BinarySearchTree<int, int> bst;
+    map<int, int> ref;
+    for(int i = 0; i < 1000; ++i) {
+        int k = rng() % 5000;
+        avl.insert(make_pair(k, i));
+        bst.insert(make_pair(k, i));
+        ref[k] = i;
+    }
+    while(!ref.empty()) {
+        pair<int, int> lo = avl.popMin();
+        EXPECT_EQ(lo.first, ref.begin()->first);
+        EXPECT_EQ(lo.second, ref.begin()->second);
+        EXPECT_EQ(bst.popMin(), lo);
+        ref.erase(ref.begin());
+        if(ref.empty()) {
+            break;
+        }
+        pair<int, int> hi = avl.popMax();
+        EXPECT_EQ(hi.first, ref.rbegin()->first);
+        EXPECT_EQ(hi.second, ref.rbegin()->second);
+        EXPECT_EQ(bst.popMax(), hi);
+        ref.erase(prev(ref.end()));
+    }
+    EXPECT_TRUE(avl.empty());
+    EXPECT_TRUE(bst.empty());
+    EXPECT_THROW(avl.popMin(), out_of_range);
+    EXPECT_THROW(avl.popMax(), out_of_range);
+    EXPECT_THROW(bst.popMin(), out_of_range);
+}
+
+TEST(PopAndErase, PopMovesTheValueOut)
+{
+    AVLTree<int, string> tree;
+    tree.insert(make_pair(1, string(100, 'a')));
+    tree.insert(make_pair(2, string(100, 'b')));
+    EXPECT_EQ(tree.popMax().second, string(100, 'b'));
+    EXPECT_EQ(tree.popMin().second, string(100, 'a'));
+}
+
+TEST(PopAndErase, EraseReturnsTheNextItem)
+{
+    mt19937 rng(16);
+    OpenAVLTree avl;
+    map<int, int> ref;
+    for(int i = 0; i < 2000; ++i) {
+        avl.insert(make_pair(i, i));
+        ref[i] = i;
+    }
+    // Erase every item whose key is a multiple of 3, walking forward
+    AVLTree<int, int>::iterator it = avl.begin();
+    while(it != avl.end()) {
+        if(it->first % 3 == 0) {
+            int next = it->first + 1;
+            ref.erase(it->first);
+            it = avl.erase(it);
+            if(it != avl.end()) {
+                EXPECT_EQ(it->first, next);
+            }
+        }
+        else {
+            ++it;
+        }
+    }
+    expectSameOrder(avl, ref);
+    checkBalances(avl.root());
+
+    for(int i = 0; i < 500; ++i) {
+        int k = rng() % 2000;
+        AVLTree<int, int>::iterator found = avl.find(k);
+        if(found != avl.end()) {
+            avl.erase(found);
+            ref.erase(k);
+        }
+    }
+    expectSameOrder(avl, ref);
+    checkBalances(avl.root());
+
+    EXPECT_THROW(avl.erase(avl.end()), out_of_range);
+    EXPECT_EQ(distance(avl.begin(), avl.end()), static_cast<ptrdiff_t>(ref.size()));
+}
+
+TEST(RangeErase, MatchesMapAndStaysBalanced)
+{
+    mt19937 rng(17);
+    for(int round = 0; round < 40; ++round) {
+        OpenAVLTree avl;
+        BinarySearchTree<int, int> bst;
+        map<int, int> ref;
+        int n = rng() % 600;
+        for(int i = 0; i < n; ++i) {
+            int k = rng() % 1000;
+            avl.insert(make_pair(k, i));
+            bst.insert(make_pair(k, i));
+            ref[k] = i;
+        }
+        int lo = rng() % 1100;
+        int hi = lo + rng() % 400;
+        AVLTree<int, int>::iterator next = avl.erase(avl.lower_bound(lo), avl.lower_bound(hi));
+        bst.erase(bst.lower_bound(lo), bst.lower_bound(hi));
+        ref.erase(ref.lower_bound(lo), ref.lower_bound(hi));
+
+        EXPECT_EQ(keyAt(next, avl.end()), keyAt(ref.lower_bound(hi), ref.end()));
+        expectSameOrder(avl, ref);
+        expectSameOrder(bst, ref);
+        checkBalances(avl.root());
+        expectCachedEnds(avl, avl.root());
+    }
+}
+
+TEST(RangeErase, KeepsSubtreeSizes)
+{
+    RankedTree tree;
+    map<int, int> ref;
+    for(int i = 0; i < 1000; ++i) {
+        tree.insert(make_pair(i, i));
+        ref[i] = i;
+    }
+    tree.erase(tree.select(100), tree.select(700));
+    ref.erase(ref.lower_bound(100), ref.lower_bound(700));
+    expectOrderStatistics(tree, ref);
+}
+
+// Fills tree and ref with n random keys below limit
+void fillRandom(AVLTree<int, int>& tree, map<int, int>& ref, int n, int limit, mt19937& rng)
+{
+    for(int i = 0; i < n; ++i) {
+        int k = rng() % limit;
+        tree.insert(make_pair(k, k));
+        ref[k] = k;
+    }
+}
+
+TEST(JoinSplit, SplitThenJoinRoundTrips)
+{
+    mt19937 rng(18);
+    for(int round = 0; round < 30; ++round) {
+        OpenAVLTree left;
+        OpenAVLTree right;
+        map<int, int> ref;
+        fillRandom(left, ref, rng() % 1000, 2000, rng);
+        int key = rng() % 2100;
+
+        left.split(key, right);
+        map<int, int> below(ref.begin(), ref.lower_bound(key));
+        map<int, int> above(ref.lower_bound(key), ref.end());
+        expectSameOrder(left, below);
+        expectSameOrder(right, above);
+        checkBalances(left.root());
+        checkBalances(right.root());
+
+        left.join(right);
+        EXPECT_TRUE(right.empty());
+        expectSameOrder(left, ref);
+        checkBalances(left.root());
+        expectCachedEnds(left, left.root());
+    }
+
+    OpenAVLTree low;
+    OpenAVLTree high;
+    low.insert(make_pair(5, 5));
+    high.insert(make_pair(3, 3));
+    EXPECT_THROW(low.join(high), invalid_argument);
+    EXPECT_THROW(low.join(make_pair(4, 4), high), invalid_argument);
+}
+
+TEST(JoinSplit, SetOperationsMatchMap)
+{
+    mt19937 rng(19);
+    for(int round = 0; round < 30; ++round) {
+        OpenAVLTree a[3];
+        OpenAVLTree b[3];
+        map<int, int> ra;
+        map<int, int> rb;
+        int na = rng() % 800;
+        int nb = rng() % 100;
+        for(int i = 0; i < na; ++i) {
+            int k = rng() % 1500;
+            ra[k] = k;
+        }
+        for(int i = 0; i < nb; ++i) {
+            int k = rng() % 1500;
+            rb[k] = -k;
+        }
+        for(int i = 0; i < 3; ++i) {
+            for(map<int, int>::iterator it = ra.begin(); it != ra.end(); ++it) {
+                a[i].insert(*it);
+            }
+            for(map<int, int>::iterator it = rb.begin(); it != rb.end(); ++it) {
+                b[i].insert(*it);
+            }
+        }
+
+        map<int, int> unioned = ra;
+        unioned.insert(rb.begin(), rb.end());
+        map<int, int> common;
+        map<int, int> difference;
+        for(map<int, int>::iterator it = ra.begin(); it != ra.end(); ++it) {
+            (rb.count(it->first) ? common : difference).insert(*it);
+        }
+
+        a[0].unionWith(b[0]);
+        a[1].intersectWith(b[1]);
+        a[2].subtract(b[2]);
+        expectSameOrder(a[0], unioned);
+        expectSameOrder(a[1], common);
+        expectSameOrder(a[2], difference);
+        for(int i = 0; i < 3; ++i) {
+            EXPECT_TRUE(b[i].empty());
+            checkBalances(a[i].root());
+            expectCachedEnds(a[i], a[i].root());
+        }
+    }
+}
+
+TEST(JoinSplit, JoinReportsItsRotations)
+{
+    // 1 has a right child 2 with a right child 3; joining 4 onto it hangs
+    // 4 below 2 and needs a double rotation there
+    AVLTree<int, int, RecordingTrace> left;
+    AVLTree<int, int, RecordingTrace> right;
+    int keys[] = { 1, 0, 2, 3 };
+    for(int k : keys) {
+        left.insert(make_pair(k, k));
+    }
+    left.getTrace().events.clear();
+    left.join(make_pair(4, 4), right);
+
+    vector<string> expected;
+    expected.push_back("rotateRight 4");
+    expected.push_back("rotateLeft 2");
+    EXPECT_EQ(left.getTrace().events, expected);
+}
+
+TEST(ParallelSetOps, MatchSerialResults)
+{
+    // Big enough that the top levels of the recursion run on the pool
+    mt19937 rng(20);
+    WorkStealingPool pool(3);
+    for(int round = 0; round < 3; ++round) {
+        OpenAVLTree serial[3];
+        OpenAVLTree parallel[3];
+        map<int, int> ra;
+        map<int, int> rb;
+        for(int i = 0; i < 60000; ++i) {
+            ra[rng() % 200000] = i;
+            rb[rng() % 200000] = -i;
+        }
+        for(int i = 0; i < 3; ++i) {
+            OpenAVLTree b1;
+            OpenAVLTree b2;
+            serial[i].bulkLoad(ra.begin(), ra.end());
+            parallel[i].bulkLoad(ra.begin(), ra.end());
+            b1.bulkLoad(rb.begin(), rb.end());
+            b2.bulkLoad(rb.begin(), rb.end());
+            if(i == 0) {
+                serial[i].unionWith(b1);
+                parallel[i].unionWith(b2, pool);
+            }
+            else if(i == 1) {
+                serial[i].intersectWith(b1);
+                parallel[i].intersectWith(b2, pool);
+            }
+            else {
+                serial[i].subtract(b1);
+                parallel[i].subtract(b2, pool);
+            }
+            EXPECT_TRUE(b2.empty());
+            map<int, int> expected(serial[i].begin(), serial[i].end());
+            expectSameOrder(parallel[i], expected);
+            checkBalances(parallel[i].root());
+            expectCachedEnds(parallel[i], parallel[i].root());
+        }
+    }
+}
+
+typedef ConcurrentAVLTree<int, int> ShardedTree;
+
+// Splits 0 to limit into shards of width step
+vector<int> evenSplits(int limit, int step)
+{
+    vector<int> splits;
+    for(int k = step; k < limit; k += step) {
+        splits.push_back(k);
+    }
+    return splits;
+}
+
+TEST(ConcurrentAVL, SplitsAreRequiredAndOrdered)
+{
+    EXPECT_THROW(ShardedTree(vector<int>()), invalid_argument);
+    EXPECT_THROW(ShardedTree(vector<int>{ 10, 10 }), invalid_argument);
+    EXPECT_THROW(ShardedTree(vector<int>{ 20, 10 }), invalid_argument);
+    ShardedTree tree(vector<int>{ 10, 20 });
+    EXPECT_EQ(tree.size(), 0u);
+}
+
+TEST(ConcurrentAVL, WritersAndReadersMatchMap)
+{
+    // Each writer owns the keys equal to its index mod writers, so it can
+    // keep its own map. The even keys below 100 stay put for the readers.
+    const int writers = 4;
+    const int limit = 4000;
+    ShardedTree tree(evenSplits(limit, 250));
+    for(int k = 0; k < 100; k += 2) {
+        tree.insert(make_pair(k, -k));
+    }
+    vector<map<int, int> > refs(writers);
+    atomic<bool> done(false);
+    atomic<int> bad(0);
+    vector<thread> threads;
+    for(int w = 0; w < writers; ++w) {
+        threads.push_back(thread([&tree, &refs, w]() {
+            mt19937 rng(w + 1);
+            map<int, int>& ref = refs[w];
+            for(int i = 0; i < 20000; ++i) {
+                int k = 100 + (rng() % ((limit - 100) / writers)) * writers + w;
+                if(rng() % 3 == 0) {
+                    if(tree.remove(k) != (ref.erase(k) == 1)) {
+                        ADD_FAILURE() << "remove " << k;
+                    }
+                }
+                else {
+                    if(tree.insert(make_pair(k, i)) != (ref.count(k) == 0)) {
+                        ADD_FAILURE() << "insert " << k;
+                    }
+                    ref[k] = i;
+                }
+            }
+        }));
+    }
+    for(int r = 0; r < 2; ++r) {
+        threads.push_back(thread([&tree, &done, &bad, limit]() {
+            while(!done.load()) {
+                int value = 0;
+                for(int k = 0; k < 100; ++k) {
+                    if(tree.find(k, value) != (k % 2 == 0) || (k % 2 == 0 && value != -k)) {
+                        ++bad;
+                    }
+                }
+                int last = -1;
+                tree.scan(0, limit, [&last, &bad](const pair<const int, int>& item) {
+                    if(item.first <= last) {
+                        ++bad;
+                    }
+                    last = item.first;
+                });
+            }
+        }));
+    }
+    for(int w = 0; w < writers; ++w) {
+        threads[w].join();
+    }
+    done.store(true);
+    for(size_t t = writers; t < threads.size(); ++t) {
+        threads[t].join();
+    }
+    EXPECT_EQ(bad.load(), 0);
+
+    map<int, int> ref;
+    for(int k = 0; k < 100; k += 2) {
+        ref[k] = -k;
+    }
+    for(int w = 0; w < writers; ++w) {
+        ref.insert(refs[w].begin(), refs[w].end());
+    }
+    EXPECT_EQ(tree.size(), ref.size());
+    for(int k = 0; k < limit; ++k) {
+        int value = 0;
+        map<int, int>::const_iterator it = ref.find(k);
+        ASSERT_EQ(tree.find(k, value), it != ref.end()) << k;
+        EXPECT_EQ(tree.contains(k), it != ref.end());
+        if(it != ref.end()) {
+            EXPECT_EQ(value, it->second);
+        }
+    }
+}
+
+TEST(ConcurrentAVL, ScanAndLowerBoundCrossShards)
+{
+    // Shards of width 100, with 300 to 600 left empty
+    ShardedTree tree(evenSplits(1000, 100));
+    map<int, int> ref;
+    mt19937 rng(11);
+    for(int i = 0; i < 600; ++i) {
+        int k = rng() % 1000;
+        if(k >= 300 && k < 600) {
+            continue;
+        }
+        tree.insert(make_pair(k, i));
+        ref[k] = i;
+    }
+    EXPECT_EQ(tree.size(), ref.size());
+
+    const int ranges[][2] = { { 0, 1000 }, { 50, 150 }, { 99, 101 }, { 250, 650 },
+                              { 300, 600 }, { 100, 100 }, { 700, 200 }, { -50, 2000 } };
+    for(size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); ++r) {
+        int lo = ranges[r][0];
+        int hi = ranges[r][1];
+        vector<pair<int, int> > seen;
+        tree.scan(lo, hi, [&seen](const pair<const int, int>& item) { seen.push_back(item); });
+        vector<pair<int, int> > expected;
+        if(lo < hi) {
+            expected.assign(ref.lower_bound(lo), ref.lower_bound(hi));
+        }
+        EXPECT_EQ(seen, expected) << lo << " to " << hi;
+    }
+
+    for(int k = -1; k <= 1000; ++k) {
+        pair<int, int> item;
+        map<int, int>::const_iterator it = ref.lower_bound(k);
+        ASSERT_EQ(tree.lower_bound(k, item), it != ref.end()) << k;
+        if(it != ref.end()) {
+            EXPECT_EQ(item.first, it->first);
+            EXPECT_EQ(item.second, it->second);
+        }
+    }
+
+    tree.clear();
+    EXPECT_EQ(tree.size(), 0u);
+    pair<int, int> item;
+    EXPECT_FALSE(tree.lower_bound(0, item));
+}
+
+TEST(ConcurrentAVL, GuardHoldsBackReclamation)
+{
+    EpochDomain& domain = EpochDomain::instance();
+    EXPECT_EQ(domain.oldestActive(), UINT64_MAX);
+    {
+        ConcurrentAVLTree<int, Counted> tree(vector<int>{ 100 });
+        {
+            EpochGuard outer;
+            EpochGuard inner;
+            EXPECT_LE(domain.oldestActive(), domain.current());
+            // Every overwrite replaces the single-node root, and none of the
+            // replaced roots can go while this thread is inside
+            for(int i = 0; i <= 100; ++i) {
+                tree.insert(make_pair(1, Counted()));
+            }
+            EXPECT_EQ(Counted::live, 101);
+        }
+        EXPECT_EQ(domain.oldestActive(), UINT64_MAX);
+        // The next batch frees everything retired so far
+        for(int i = 0; i < 32; ++i) {
+            tree.insert(make_pair(1, Counted()));
+        }
+        EXPECT_LE(Counted::live, 32);
+        EXPECT_EQ(tree.size(), 1u);
+    }
+    EXPECT_EQ(Counted::live, 0);
+}
+
+typedef PersistentAVLTree<int, int> PTree;
+
+// Checks that a forward-only tree holds exactly the items of ref, in order
+template<typename Tree, typename Map>
+void expectSameItems(const Tree& tree, const Map& ref)
+{
+    typename Map::const_iterator expected = ref.begin();
+    for(typename Tree::const_iterator it = tree.begin(); it != tree.end(); ++it, ++expected) {
+        ASSERT_NE(expected, ref.end());
+        EXPECT_EQ(it->first, expected->first);
+        EXPECT_EQ(it->second, expected->second);
+    }
+    EXPECT_EQ(expected, ref.end());
+}
+
+TEST(Persistent, SnapshotsDoNotChange)
+{
+    mt19937 rng(5);
+    PTree tree;
+    map<int, int> ref;
+    vector<PTree> snapshots;
+    vector<map<int, int> > expected;
+    for(int i = 0; i < 5000; ++i) {
+        int k = rng() % 1000;
+        if(rng() % 3 == 0) {
+            EXPECT_EQ(tree.remove(k), ref.erase(k) == 1);
+        }
+        else {
+            EXPECT_EQ(tree.insert(make_pair(k, i)), ref.count(k) == 0);
+            ref[k] = i;
+        }
+        if(i % 250 == 0) {
+            snapshots.push_back(tree);
+            expected.push_back(ref);
+        }
+    }
+    expectSameItems(tree, ref);
+    EXPECT_EQ(tree.size(), ref.size());
+    for(size_t i = 0; i < snapshots.size(); ++i) {
+        expectSameItems(snapshots[i], expected[i]);
+        EXPECT_EQ(snapshots[i].size(), expected[i].size());
+    }
+}
+
+TEST(Persistent, StaysBalanced)
+{
+    PTree tree;
+    for(int i = 0; i < (1 << 12); ++i) {
+        tree.insert(make_pair(i, i));
+    }
+    // An AVL tree of 2^12 nodes is at most 1.44 * 13 levels tall
+    EXPECT_LE(tree.height(), 18);
+    for(int i = 0; i < (1 << 12); i += 2) {
+        EXPECT_TRUE(tree.remove(i));
+    }
+    EXPECT_LE(tree.height(), 17);
+    EXPECT_EQ(tree.size(), size_t(1 << 11));
+    EXPECT_FALSE(tree.contains(0));
+    EXPECT_TRUE(tree.contains(1));
+    ASSERT_NE(tree.find(1001), tree.end());
+    EXPECT_EQ(tree.find(1001)->second, 1001);
+    EXPECT_EQ(tree.find(1000), tree.end());
+}
+
+TEST(Persistent, CopiesAreIndependent)
+{
+    PTree a;
+    a.insert(make_pair(1, 1));
+    a.insert(make_pair(2, 2));
+    PTree b(a);
+    b.insert(make_pair(2, 20));
+    b.remove(1);
+    a.insert(make_pair(3, 3));
+    expectSameItems(a, map<int, int>{ {1, 1}, {2, 2}, {3, 3} });
+    expectSameItems(b, map<int, int>{ {2, 20} });
+
+    a = b;
+    a.clear();
+    EXPECT_TRUE(a.empty());
+    expectSameItems(b, map<int, int>{ {2, 20} });
+}
+
+TEST(Persistent, PublisherHandsOutWholeVersions)
+{
+    // Version v holds keys 0 to v - 1, each mapped to its square, so a
+    // reader can tell a torn snapshot from a whole one
+    const int versions = 5000;
+    SnapshotPublisher<int, int> publisher;
+    atomic<bool> done(false);
+    atomic<int> bad(0);
+    vector<thread> readers;
+    for(int r = 0; r < 3; ++r) {
+        readers.push_back(thread([&]() {
+            int last = 0;
+            while(!done.load()) {
+                PTree snapshot = publisher.snapshot();
+                int v = static_cast<int>(snapshot.size());
+                int expectedKey = 0;
+                for(PTree::const_iterator it = snapshot.begin(); it != snapshot.end(); ++it, ++expectedKey) {
+                    if(it->first != expectedKey || it->second != expectedKey * expectedKey) {
+                        ++bad;
+                    }
+                }
+                if(expectedKey != v || v < last) {
+                    ++bad;
+                }
+                last = v;
+            }
+        }));
+    }
+
+    PTree tree;
+    for(int v = 1; v <= versions; ++v) {
+        tree.insert(make_pair(v - 1, (v - 1) * (v - 1)));
+        publisher.publish(tree);
+    }
+    done.store(true);
+    for(size_t r = 0; r < readers.size(); ++r) {
+        readers[r].join();
+    }
+    EXPECT_EQ(bad.load(), 0);
+    EXPECT_EQ(publisher.snapshot().size(), size_t(versions));
+}
+
+TEST(Persistent, RetiredRootsStayBoundedUnderSteadyReaders)
+{
+    // Two readers call snapshot() nonstop, each inside an outer guard that
+    // they take turns renewing, so some reader is always active. Only the
+    // roots retired since the older of the two guards may be held back.
+    const int rounds = 40;
+    const int perRound = 256;
+    SnapshotPublisher<int, int> publisher;
+    atomic<int> round(0);
+    atomic<int> seen[2];
+    atomic<bool> done(false);
+    atomic<int> bad(0);
+    vector<thread> readers;
+    for(int r = 0; r < 2; ++r) {
+        seen[r].store(0);
+        readers.push_back(thread([&, r]() {
+            unique_ptr<EpochGuard> pin(new EpochGuard());
+            size_t last = 0;
+            while(!done.load()) {
+                int k = round.load();
+                if(k != seen[r].load()) {
+                    if(k % 2 == r) {
+                        pin.reset();
+                        pin.reset(new EpochGuard());
+                    }
+                    seen[r].store(k);
+                }
+                size_t v = publisher.snapshot().size();
+                if(v < last) {
+                    ++bad;
+                }
+                last = v;
+            }
+        }));
+    }
+
+    PTree tree;
+    size_t most = 0;
+    for(int k = 1; k <= rounds; ++k) {
+        round.store(k);
+        while(seen[0].load() != k || seen[1].load() != k) {
+            this_thread::yield();
+        }
+        for(int i = 0; i < perRound; ++i) {
+            tree.insert(make_pair(k * perRound + i, i));
+            publisher.publish(tree);
+            most = max(most, publisher.retiredCount());
+        }
+    }
+    done.store(true);
+    for(size_t r = 0; r < readers.size(); ++r) {
+        readers[r].join();
+    }
+    EXPECT_EQ(bad.load(), 0);
+    // Two rounds' worth, plus what the last batch before them left over
+    EXPECT_LE(most, size_t(3 * perRound));
+    EXPECT_GE(most, size_t(perRound));
+
+    // With no reader left, the next batch releases everything
+    for(int i = 0; i < 32; ++i) {
+        publisher.publish(tree);
+    }
+    EXPECT_LT(publisher.retiredCount(), 32u);
+}
+
+// Fills shape the obvious recursive way, for profileShape to match
+void referenceShape(Node<int, int>* node, size_t depth, TreeShape& shape)
+{
+    if(node == NULL) {
+        return;
+    }
+    if(shape.levelWidths.size() <= depth) {
+        shape.levelWidths.resize(depth + 1, 0);
+    }
+    ++shape.levelWidths[depth];
+    if(node->getLeft() == NULL && node->getRight() == NULL) {
+        if(shape.leafDepths.size() <= depth) {
+            shape.leafDepths.resize(depth + 1, 0);
+        }
+        ++shape.leafDepths[depth];
+    }
+    referenceShape(node->getLeft(), depth + 1, shape);
+    referenceShape(node->getRight(), depth + 1, shape);
+}
+
+TEST(TreeShape, MatchesRecursiveWalk)
+{
+    mt19937 rng(23);
+    for(int round = 0; round < 40; ++round) {
+        OpenBST<> bst;
+        OpenAVLTree avl;
+        int n = rng() % 2000;
+        for(int i = 0; i < n; ++i) {
+            int k = rng() % 5000;
+            bst.insert(make_pair(k, i));
+            avl.insert(make_pair(k, i));
+        }
+        Node<int, int>* roots[] = { bst.root(), avl.root() };
+        TreeShape shapes[] = { bst.shape(), avl.shape() };
+        for(int t = 0; t < 2; ++t) {
+            TreeShape expected;
+            referenceShape(roots[t], 0, expected);
+            const TreeShape& shape = shapes[t];
+            EXPECT_EQ(shape.levelWidths, expected.levelWidths);
+            EXPECT_EQ(shape.height, static_cast<int>(expected.levelWidths.size()));
+            size_t nodes = 0;
+            for(size_t d = 0; d < expected.levelWidths.size(); ++d) {
+                nodes += expected.levelWidths[d];
+            }
+            EXPECT_EQ(shape.nodes, nodes);
+            // The reference stops at the deepest leaf, like profileShape
+            EXPECT_EQ(shape.leafDepths, expected.leafDepths);
+            if(n == 0) {
+                EXPECT_EQ(shape.minLeafDepth, -1);
+                continue;
+            }
+            size_t minDepth = 0;
+            while(expected.leafDepths[minDepth] == 0) {
+                ++minDepth;
+            }
+            EXPECT_EQ(shape.minLeafDepth, static_cast<int>(minDepth));
+            EXPECT_EQ(shape.maxLeafDepth, static_cast<int>(expected.leafDepths.size()) - 1);
+        }
+    }
+}
+
+TEST(TreeShape, PerfectAndChainShapes)
+{
+    // Sorted inserts of 2^10 - 1 keys leave an AVL tree perfect
+    AVLTree<int, int> avl;
+    for(int i = 0; i < 1023; ++i) {
+        avl.insert(make_pair(i, i));
+    }
+    TreeShape shape = avl.shape();
+    EXPECT_EQ(shape.nodes, 1023u);
+    EXPECT_EQ(shape.leaves, 512u);
+    EXPECT_EQ(shape.height, 10);
+    EXPECT_TRUE(shape.equalPaths());
+    for(size_t d = 0; d < shape.levelWidths.size(); ++d) {
+        EXPECT_EQ(shape.levelWidths[d], size_t(1) << d);
+    }
+    avl.insert(make_pair(1023, 1023));
+    EXPECT_FALSE(avl.shape().equalPaths());
+
+    // A million-deep chain must not recurse
+    OpenBST<> chain;
+    chain.makeChain(1000000);
+    shape = chain.shape();
+    EXPECT_EQ(shape.nodes, 1000000u);
+    EXPECT_EQ(shape.leaves, 1u);
+    EXPECT_EQ(shape.height, 1000000);
+    EXPECT_EQ(shape.minLeafDepth, 999999);
+    EXPECT_TRUE(shape.equalPaths());
+
+    BinarySearchTree<int, int> empty;
+    shape = empty.shape();
+    EXPECT_EQ(shape.nodes, 0u);
+    EXPECT_EQ(shape.height, 0);
+    EXPECT_EQ(shape.minLeafDepth, -1);
+    EXPECT_TRUE(shape.equalPaths());
+}
+
+TEST(BSTBalanceCache, MatchesDeepCheck)
+{
+    mt19937 rng(11);
+    for(int round = 0; round < 100; ++round) {
+        BinarySearchTree<int, int> tree;
+        int range = 1 + rng() % 300;
+        if(round % 5 == 0) {
+            vector<pair<int, int> > items;
+            for(int i = 0; i < int(rng() % 100); ++i) {
+                items.push_back(make_pair(int(rng() % range), i));
+            }
+            tree.bulkLoad(items.begin(), items.end());
+            EXPECT_EQ(tree.isBalanced(), tree.isBalancedDeep());
+        }
+        for(int op = 0; op < 300; ++op) {
+            int k = rng() % range;
+            int roll = rng() % 10;
+            if(roll < 5) {
+                tree.insert(make_pair(k, k));
+            }
+            else if(roll < 8) {
+                tree.remove(k);
+            }
+            else if(!tree.empty()) {
+                if(roll == 8) {
+                    tree.popMin();
+                }
+                else {
+                    tree.popMax();
+                }
+            }
+            // Ask only now and then, so stale heights pile up in between
+            if(rng() % 7 == 0) {
+                EXPECT_EQ(tree.isBalanced(), tree.isBalancedDeep());
+            }
+        }
+        EXPECT_EQ(tree.isBalanced(), tree.isBalancedDeep());
+        tree.clear();
+        EXPECT_TRUE(tree.isBalanced());
+    }
+}
+
+TEST(BSTBalanceCache, DegenerateTree)
+{
+    // Deep enough to overflow a recursive height check; appending at end()
+    // keeps the build linear
+    BinarySearchTree<int, int> tree;
+    for(int i = 0; i < 200000; ++i) {
+        tree.insert(tree.end(), make_pair(i, i));
+    }
+    EXPECT_FALSE(tree.isBalancedDeep());
+    EXPECT_FALSE(tree.isBalanced());
+    for(int i = 0; i < 199998; ++i) {
+        tree.popMax();
+    }
+    EXPECT_TRUE(tree.isBalanced());
+    EXPECT_TRUE(tree.isBalancedDeep());
+}
+
+TEST(BSTBalanceCache, AVLTreesAreAlwaysBalanced)
+{
+    AVLTree<int, int> tree;
+    for(int i = 0; i < 1000; ++i) {
+        tree.insert(make_pair(i * 37 % 1000, i));
+        if(i % 3 == 0) {
+            tree.remove(i * 11 % 1000);
+        }
+    }
+    EXPECT_TRUE(tree.isBalanced());
+    EXPECT_TRUE(tree.isBalancedDeep());
+}
+
+#ifdef BST_CHECK_BALANCE
+TEST(BSTBalanceCache, CrossCheckCatchesABadCount)
+{
+    // A perfect tree, so the bad count turns a true answer false
+    OpenBST<> tree;
+    const int keys[] = { 3, 1, 5, 0, 2, 4, 6 };
+    for(int i = 0; i < 7; ++i) {
+        tree.insert(make_pair(keys[i], i));
+    }
+    EXPECT_TRUE(tree.isBalanced());
+    tree.corruptBalanceCount();
+    EXPECT_THROW(tree.isBalanced(), logic_error);
+}
+#endif
+
+/**
+ * An AVLTree on ints that exposes its nodes and cached ends, so a test can
+ * corrupt one invariant at a time and check that verify reports it.
+ */
+template<class Augment = NoAugment>
+class CorruptibleAVLTree : public AVLTree<int, int, NoTrace, NewNodeAllocator, Augment>
+{
+public:
+    typedef AVLNode<int, int, Augment> NodeT;
+
+    NodeT* root() { return static_cast<NodeT*>(this->root_); }
+    Node<int, int>* leftmost() { return this->leftmost_; }
+    void setLeftmost(Node<int, int>* node) { this->leftmost_ = node; }
+};
+
+// Returns the message verify throws, or "" if the tree passes
+template<typename Tree>
+string verifyError(const Tree& tree)
+{
+    try {
+        tree.verify();
+    }
+    catch(const logic_error& e) {
+        return e.what();
+    }
+    return "";
+}
+
+template<typename Tree, typename Pool>
+string verifyError(const Tree& tree, Pool& pool)
+{
+    try {
+        tree.verify(pool);
+    }
+    catch(const logic_error& e) {
+        return e.what();
+    }
+    return "";
+}
+
+// Keys 1 to 7, inserted so the tree comes out perfect with 4 at the root
+template<typename Tree>
+void fillPerfect(Tree& tree)
+{
+    const int keys[] = { 4, 2, 6, 1, 3, 5, 7 };
+    for(size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+}
+
+TEST(AVLVerify, ValidTreesPass)
+{
+    CorruptibleAVLTree<SubtreeSize> tree;
+    EXPECT_EQ(verifyError(tree), "");
+    for(int i = 0; i < 1000; ++i) {
+        tree.insert(make_pair((i * 7919) % 1009, i));
+        if(i % 3 == 0) {
+            tree.remove((i * 31) % 1009);
+        }
+    }
+    EXPECT_EQ(verifyError(tree), "");
+}
+
+TEST(AVLVerify, WrongBalance)
+{
+    CorruptibleAVLTree<> tree;
+    fillPerfect(tree);
+    tree.root()->setBalance(1);
+    EXPECT_EQ(verifyError(tree), "verify: balance does not match subtree heights at depth 0");
+    tree.root()->setBalance(0);
+    EXPECT_EQ(verifyError(tree), "");
+}
+
+TEST(AVLVerify, KeyOutOfOrder)
+{
+    CorruptibleAVLTree<> tree;
+    fillPerfect(tree);
+    // Swapping 2's children keeps every link, height and size intact
+    CorruptibleAVLTree<>::NodeT* two = tree.root()->getLeft();
+    Node<int, int>* one = two->getLeft();
+    two->setLeft(two->getRight());
+    two->setRight(one);
+    EXPECT_EQ(verifyError(tree), "verify: key out of order at depth 2");
+    two->setRight(two->getLeft());
+    two->setLeft(one);
+    EXPECT_EQ(verifyError(tree), "");
+}
+
+TEST(AVLVerify, WrongParent)
+{
+    CorruptibleAVLTree<> tree;
+    fillPerfect(tree);
+    Node<int, int>* one = tree.leftmost();
+    Node<int, int>* two = one->getParent();
+    one->setParent(tree.root());
+    EXPECT_EQ(verifyError(tree), "verify: parent pointer does not match at depth 2");
+    one->setParent(two);
+    EXPECT_EQ(verifyError(tree), "");
+}
+
+TEST(AVLVerify, WrongSubtreeSize)
+{
+    CorruptibleAVLTree<SubtreeSize> tree;
+    fillPerfect(tree);
+    CorruptibleAVLTree<SubtreeSize>::NodeT* one =
+        static_cast<CorruptibleAVLTree<SubtreeSize>::NodeT*>(tree.leftmost());
+    SubtreeSize::adjustPath(one, 1);
+    EXPECT_EQ(verifyError(tree), "verify: subtree size does not match at depth 2");
+    SubtreeSize::adjustPath(one, -1);
+    EXPECT_EQ(verifyError(tree), "");
+}
+
+TEST(AVLVerify, StaleEnds)
+{
+    CorruptibleAVLTree<> tree;
+    fillPerfect(tree);
+    Node<int, int>* one = tree.leftmost();
+    tree.setLeftmost(tree.root());
+    EXPECT_EQ(verifyError(tree), "verify: leftmost or rightmost node is stale");
+    tree.setLeftmost(one);
+    EXPECT_EQ(verifyError(tree), "");
+}
+
+TEST(AVLVerify, ParallelMatchesSerial)
+{
+    // Tall enough that verify(pool) forks rather than running serially
+    CorruptibleAVLTree<SubtreeSize> tree;
+    vector<pair<int, int> > items;
+    for(int i = 0; i < (1 << 16); ++i) {
+        items.push_back(make_pair(i, i));
+    }
+    tree.bulkLoad(items.begin(), items.end());
+
+    WorkStealingPool pool(4);
+    EXPECT_EQ(verifyError(tree, pool), "");
+
+    Node<int, int>* first = tree.leftmost();
+    Node<int, int>* parent = first->getParent();
+    first->setParent(tree.root());
+    EXPECT_EQ(verifyError(tree, pool), verifyError(tree));
+    EXPECT_NE(verifyError(tree, pool), "");
+    first->setParent(parent);
+    EXPECT_EQ(verifyError(tree, pool), "");
+}
+
+#ifdef DEBUG
+TEST(AVLVerify, DebugHookCatchesCorruption)
+{
+    CorruptibleAVLTree<> tree;
+    fillPerfect(tree);
+    Node<int, int>* one = tree.leftmost();
+    Node<int, int>* two = one->getParent();
+    one->setParent(tree.root());
+
+    // Off by default; then every third mutation runs verify
+    EXPECT_NO_THROW(tree.insert(make_pair(8, 8)));
+    tree.setVerifyInterval(3);
+    EXPECT_NO_THROW(tree.insert(make_pair(9, 9)));
+    EXPECT_NO_THROW(tree.remove(9));
+    EXPECT_THROW(tree.insert(make_pair(10, 10)), logic_error);
+
+    one->setParent(two);
+    tree.setVerifyInterval(1);
+    EXPECT_NO_THROW(tree.insert(make_pair(11, 11)));
+    EXPECT_NO_THROW(tree.remove(11));
+}
+
+TEST(AVLVerify, BulkLoadCountsAsAMutation)
+{
+    CorruptibleAVLTree<> tree;
+    tree.setVerifyInterval(2);
+    tree.insert(make_pair(0, 0));
+    vector<pair<int, int> > items;
+    for(int i = 1; i <= 7; ++i) {
+        items.push_back(make_pair(i, i));
+    }
+    // The second mutation, so the freshly loaded tree is verified
+    tree.bulkLoad(items.begin(), items.end());
 
-    return 0;
-}
\ No newline at end of file
+    Node<int, int>* one = tree.leftmost();
+    Node<int, int>* two = one->getParent();
+    one->setParent(tree.root());
+    EXPECT_NO_THROW(tree.insert(make_pair(8, 8)));
+    EXPECT_THROW(tree.insert(make_pair(9, 9)), logic_error);
+    one->setParent(two);
+}
+#endif
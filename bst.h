@@ -3,22 +3,78 @@
 
 #include <iostream>
 #include <exception>
+#include <stdexcept>
 #include <cstdlib>
 #include <utility>
+#include <tuple>
+#include <functional>
+#include <iterator>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include "node-alloc.h"
+#include "tree-shape.h"
+
+/**
+ * Builds the item of a new node. Insertion wraps its arguments in one of
+ * these (see ItemFrom) and hands it to the tree's createNode hook, which
+ * picks the node type; build() returns the item by value straight into the
+ * node's item_, so nothing is copied or moved on the way.
+ */
+template <typename Key, typename Value>
+class ItemSource
+{
+public:
+    virtual std::pair<const Key, Value> build() = 0;
+
+protected:
+    ~ItemSource() {}
+};
+
+/**
+ * An ItemSource that calls make(), usually a lambda holding references to
+ * the insertion arguments.
+ */
+template <typename Key, typename Value, typename Make>
+class ItemFrom : public ItemSource<Key, Value>
+{
+public:
+    explicit ItemFrom(Make make) : make_(make) {}
+
+    std::pair<const Key, Value> build() { return make_(); }
+
+private:
+    Make make_;
+};
+
+template <typename Key, typename Value, typename Make>
+ItemFrom<Key, Value, Make> itemFrom(Make make)
+{
+    return ItemFrom<Key, Value, Make>(make);
+}
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are not virtual: derived nodes such
+ * as AVLNode hide them with versions that return their own type, so a
+ * child hop is a plain load instead of an indirect call and nodes carry
+ * no vtable pointer.
+ *
+ * The parent pointer shares its word with a small tag in the low bits
+ * (nodes are at least 8-byte aligned, leaving 3 bits free). Plain BST
+ * nodes leave it zero; AVLNode keeps its balance there.
  */
 template <typename Key, typename Value>
-class Node
+class alignas(8) Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
-    virtual ~Node();
+    template<typename... Args>
+    explicit Node(Node<Key, Value>* parent, Args&&... itemArgs);
+    Node(ItemSource<Key, Value>& source, Node<Key, Value>* parent);
+    ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
     std::pair<const Key, Value>& getItem();
@@ -26,18 +82,24 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
     void setRight(Node<Key, Value>* right);
     void setValue(const Value &value);
+    void setValue(Value&& value);
 
 protected:
+    static const uintptr_t TAG_MASK = 7;
+
+    uintptr_t getTag() const;
+    void setTag(uintptr_t tag);
+
     std::pair<const Key, Value> item_;
-    Node<Key, Value>* parent_;
+    uintptr_t parentAndTag_;
     Node<Key, Value>* left_;
     Node<Key, Value>* right_;
 };
@@ -54,7 +116,36 @@ protected:
 template<typename Key, typename Value>
 Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* parent) :
     item_(key, value),
-    parent_(parent),
+    parentAndTag_(reinterpret_cast<uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* Constructs the item in place from itemArgs, forwarded to the
+* std::pair<const Key, Value> constructor, so nothing is copied that the
+* caller hands over by rvalue.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+Node<Key, Value>::Node(Node<Key, Value>* parent, Args&&... itemArgs) :
+    item_(std::forward<Args>(itemArgs)...),
+    parentAndTag_(reinterpret_cast<uintptr_t>(parent)),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* Constructs the item from source; see ItemSource.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>::Node(ItemSource<Key, Value>& source, Node<Key, Value>* parent) :
+    item_(source.build()),
+    parentAndTag_(reinterpret_cast<uintptr_t>(parent)),
     left_(NULL),
     right_(NULL)
 {
@@ -118,16 +209,16 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent, with the tag bits masked off.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
 {
-    return parent_;
+    return reinterpret_cast<Node<Key, Value>*>(parentAndTag_ & ~TAG_MASK);
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +227,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -145,12 +236,12 @@ Node<Key, Value>* Node<Key, Value>::getRight() const
 }
 
 /**
-* A setter for setting the parent of a node.
+* A setter for setting the parent of a node. The tag bits are preserved.
 */
 template<typename Key, typename Value>
 void Node<Key, Value>::setParent(Node<Key, Value>* parent)
 {
-    parent_ = parent;
+    parentAndTag_ = reinterpret_cast<uintptr_t>(parent) | (parentAndTag_ & TAG_MASK);
 }
 
 /**
@@ -180,6 +271,30 @@ void Node<Key, Value>::setValue(const Value& value)
     item_.second = value;
 }
 
+template<typename Key, typename Value>
+void Node<Key, Value>::setValue(Value&& value)
+{
+    item_.second = std::move(value);
+}
+
+/**
+* A getter for the tag bits stored beside the parent pointer.
+*/
+template<typename Key, typename Value>
+uintptr_t Node<Key, Value>::getTag() const
+{
+    return parentAndTag_ & TAG_MASK;
+}
+
+/**
+* A setter for the tag bits. Only the low three bits of tag are kept.
+*/
+template<typename Key, typename Value>
+void Node<Key, Value>::setTag(uintptr_t tag)
+{
+    parentAndTag_ = (parentAndTag_ & ~TAG_MASK) | (tag & TAG_MASK);
+}
+
 /*
   ---------------------------------------
   End implementations for the Node class.
@@ -187,57 +302,279 @@ void Node<Key, Value>::setValue(const Value& value)
 */
 
 /**
-* A templated unbalanced binary search tree.
-*/
+ * The node of a plain BinarySearchTree. It caches the height of its
+ * subtree, and uses tag bit 0 to flag that its children's heights differ
+ * by more than one, so the tree can keep a running count of such nodes.
+ * Tag bit 1 marks the cached height as stale after a change below it.
+ */
 template <typename Key, typename Value>
+class HeightNode : public Node<Key, Value>
+{
+public:
+    HeightNode(const Key& key, const Value& value, HeightNode<Key, Value>* parent);
+    template<typename... Args>
+    explicit HeightNode(HeightNode<Key, Value>* parent, Args&&... itemArgs);
+    HeightNode(ItemSource<Key, Value>& source, HeightNode<Key, Value>* parent);
+
+    int getHeight() const;
+    void setHeight(int height);
+    bool isUnbalanced() const;
+    void setUnbalanced(bool unbalanced);
+    bool isStale() const;
+    void setStale(bool stale);
+
+protected:
+    int height_;
+};
+
+template<typename Key, typename Value>
+HeightNode<Key, Value>::HeightNode(const Key& key, const Value& value, HeightNode<Key, Value>* parent) :
+    Node<Key, Value>(key, value, parent),
+    height_(1)
+{
+
+}
+
+/**
+* Builds the item in place; see the matching Node constructor.
+*/
+template<typename Key, typename Value>
+template<typename... Args>
+HeightNode<Key, Value>::HeightNode(HeightNode<Key, Value>* parent, Args&&... itemArgs) :
+    Node<Key, Value>(parent, std::forward<Args>(itemArgs)...),
+    height_(1)
+{
+
+}
+
+template<typename Key, typename Value>
+HeightNode<Key, Value>::HeightNode(ItemSource<Key, Value>& source, HeightNode<Key, Value>* parent) :
+    Node<Key, Value>(source, parent),
+    height_(1)
+{
+
+}
+
+template<typename Key, typename Value>
+int HeightNode<Key, Value>::getHeight() const
+{
+    return height_;
+}
+
+template<typename Key, typename Value>
+void HeightNode<Key, Value>::setHeight(int height)
+{
+    height_ = height;
+}
+
+template<typename Key, typename Value>
+bool HeightNode<Key, Value>::isUnbalanced() const
+{
+    return (this->getTag() & 1) != 0;
+}
+
+template<typename Key, typename Value>
+void HeightNode<Key, Value>::setUnbalanced(bool unbalanced)
+{
+    this->setTag((this->getTag() & ~uintptr_t(1)) | (unbalanced ? 1 : 0));
+}
+
+template<typename Key, typename Value>
+bool HeightNode<Key, Value>::isStale() const
+{
+    return (this->getTag() & 2) != 0;
+}
+
+template<typename Key, typename Value>
+void HeightNode<Key, Value>::setStale(bool stale)
+{
+    this->setTag((this->getTag() & ~uintptr_t(2)) | (stale ? 2 : 0));
+}
+
+/**
+* True when a K can be used to probe a tree of Key ordered by Compare
+* without first building a Key from it: K is a different type and Compare
+* is transparent (it has an is_transparent member, as std::less<void>
+* does). Trees enable their heterogeneous lookup overloads (find,
+* lower_bound, remove, ...) only then, like std::map, so a lookup with a
+* const char* on a std::less<> tree of std::string keys never allocates a
+* temporary, while the default std::less<Key> keeps converting the probe
+* to a Key.
+*/
+template<typename Compare, typename = void>
+struct IsTransparent : std::false_type
+{
+};
+
+template<typename Compare>
+struct IsTransparent<Compare, decltype(void(sizeof(typename Compare::is_transparent*)))> : std::true_type
+{
+};
+
+template<typename Key, typename Compare, typename K>
+struct HeterogeneousKey :
+    std::integral_constant<bool,
+        !std::is_same<typename std::decay<K>::type, Key>::value && IsTransparent<Compare>::value>
+{
+};
+
+/**
+* A templated unbalanced binary search tree. Alloc is the node allocation
+* policy (see node-alloc.h) and Compare is the strict weak ordering on keys.
+* Every descent asks Compare once per level and settles equality with one
+* extra call at the bottom.
+*/
+template <typename Key, typename Value, typename Alloc = NewNodeAllocator,
+          typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp);
+    template<typename FwdIter>
+    BinarySearchTree(FwdIter first, FwdIter last);
     virtual ~BinarySearchTree(); //TODO
-    virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
-    virtual void remove(const Key& key); //TODO
-    void clear(); //TODO
-    bool isBalanced() const; //TODO
+    virtual void insert(const std::pair<const Key, Value>& keyValuePair);
+    virtual void remove(const Key& key);
+    template<typename K, typename = typename std::enable_if<HeterogeneousKey<Key, Compare, K>::value>::type>
+    void remove(const K& key);
+    void clear();
+    template<typename FwdIter>
+    void bulkLoad(FwdIter first, FwdIter last);
+    bool isBalanced();
+    bool isBalancedDeep() const;
+    TreeShape shape() const;
     void print() const;
     bool empty() const;
 
+    Alloc& getAllocator();
+    const Compare& key_comp() const;
+
     template<typename PPKey, typename PPValue>
     friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
 public:
     /**
-    * An internal iterator class for traversing the contents of the BST.
+    * An internal bidirectional iterator class template for traversing the
+    * contents of the BST in key order. ItemT is the item type handed out,
+    * so one implementation serves both iterator and const_iterator.
+    * Decrementing end() yields the largest item.
     */
-    class iterator  // TODO
+    template<typename ItemT>
+    class basic_iterator
     {
     public:
-        iterator();
-
-        std::pair<const Key,Value>& operator*() const;
-        std::pair<const Key,Value>* operator->() const;
-
-        bool operator==(const iterator& rhs) const;
-        bool operator!=(const iterator& rhs) const;
-
-        iterator& operator++();
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef ItemT* pointer;
+        typedef ItemT& reference;
+
+        basic_iterator();
+        // iterator to const_iterator; a template, so it never stands in for
+        // the implicit copy constructor
+        template<typename OtherItemT, typename = typename std::enable_if<
+            std::is_same<OtherItemT, std::pair<const Key, Value> >::value &&
+            !std::is_same<OtherItemT, ItemT>::value>::type>
+        basic_iterator(const basic_iterator<OtherItemT>& other);
+
+        ItemT& operator*() const;
+        ItemT* operator->() const;
+
+        bool operator==(const basic_iterator& rhs) const;
+        bool operator!=(const basic_iterator& rhs) const;
+
+        basic_iterator& operator++();
+        basic_iterator operator++(int);
+        basic_iterator& operator--();
+        basic_iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Alloc, Compare>;
+        template<typename OtherItemT> friend class basic_iterator;
+        basic_iterator(Node<Key,Value>* ptr, const BinarySearchTree<Key, Value, Alloc, Compare>* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree<Key, Value, Alloc, Compare>* tree_;
     };
 
+    typedef basic_iterator<std::pair<const Key, Value> > iterator;
+    typedef basic_iterator<const std::pair<const Key, Value> > const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
+    iterator min() const;
+    iterator max() const;
     iterator find(const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    template<typename Visitor>
+    void forEachInRange(const Key& lo, const Key& hi, Visitor fn) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Heterogeneous lookups; see HeterogeneousKey
+    template<typename K, typename = typename std::enable_if<HeterogeneousKey<Key, Compare, K>::value>::type>
+    iterator find(const K& key) const;
+    template<typename K, typename = typename std::enable_if<HeterogeneousKey<Key, Compare, K>::value>::type>
+    iterator lower_bound(const K& key) const;
+    template<typename K, typename = typename std::enable_if<HeterogeneousKey<Key, Compare, K>::value>::type>
+    iterator upper_bound(const K& key) const;
+    template<typename K, typename = typename std::enable_if<HeterogeneousKey<Key, Compare, K>::value>::type>
+    Value& operator[](const K& key);
+    template<typename K, typename = typename std::enable_if<HeterogeneousKey<Key, Compare, K>::value>::type>
+    Value const & operator[](const K& key) const;
+
+    // In-place insertion; the item is built inside the node from the
+    // arguments, so rvalues are moved in and never copied
+    template<typename P, typename = typename std::enable_if<
+        std::is_constructible<std::pair<const Key, Value>, P&&>::value>::type>
+    void insert(P&& keyValuePair);
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& obj);
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(Key&& key, M&& obj);
+
+    // Hinted insertion: O(1) apart from rebalancing when the key belongs
+    // right next to hint, otherwise the same as insert
+    iterator insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    template<typename P, typename = typename std::enable_if<
+        std::is_constructible<std::pair<const Key, Value>, P&&>::value>::type>
+    iterator insert(const_iterator hint, P&& keyValuePair);
+
+    // Removal of nodes the caller already holds; nothing is searched by key
+    iterator erase(const_iterator pos);
+    iterator erase(const_iterator first, const_iterator last);
+    std::pair<Key, Value> popMin();
+    std::pair<Key, Value> popMax();
+
 protected:
     // Mandatory helper functions
-    Node<Key, Value>* internalFind(const Key& k) const; // TODO
-    Node<Key, Value> *getSmallestNode() const;  // TODO
+    template<typename K>
+    Node<Key, Value>* internalFind(const K& k) const;
+    template<typename K>
+    Node<Key, Value>* internalLowerBound(const K& k) const;
+    template<typename K>
+    Node<Key, Value>* internalUpperBound(const K& k) const;
+    Node<Key, Value> *getSmallestNode() const;
+    Node<Key, Value> *getLargestNode() const;
+    static Node<Key, Value>* findSmallest(Node<Key, Value>* node);
+    static Node<Key, Value>* findLargest(Node<Key, Value>* node);
+    iterator makeIterator(Node<Key, Value>* node) const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
@@ -247,16 +584,63 @@ protected:
     virtual void nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2) ;
 
     // Add helper functions here
+    template<typename A, typename B>
+    bool keyLess(const A& a, const B& b) const;
     int checkBalanced(Node<Key, Value>* node) const;
+    static int cachedHeight(Node<Key, Value>* node);
+    void markStale(Node<Key, Value>* node);
+    void refreshStale();
     static Node<Key, Value>* successor(Node<Key, Value>* current);
 		virtual void transplant(Node<Key, Value>* u, Node<Key, Value>* v);
+    virtual void removeNode(Node<Key, Value>* node);
+    virtual void eraseRange(Node<Key, Value>* first, Node<Key, Value>* last);
+
+    // Insertion helpers, shared with derived trees. findSlot returns the
+    // node holding key, or null along with the parent and side a new node
+    // would hang from; createNode builds a node of the tree's own type, and
+    // linkNode hangs it there and calls afterInsert so a derived tree can
+    // rebalance.
+    template<typename K>
+    Node<Key, Value>* findSlot(const K& key, Node<Key, Value>*& parent, bool& goLeft) const;
+    template<typename K>
+    Node<Key, Value>* findSlotNear(const_iterator hint, const K& key,
+                                   Node<Key, Value>*& parent, bool& goLeft) const;
+    void linkNode(Node<Key, Value>* node, Node<Key, Value>* parent, bool goLeft);
+    virtual void afterInsert(Node<Key, Value>* node);
+    virtual Node<Key, Value>* createNode(ItemSource<Key, Value>& source);
+    template<typename... Args>
+    std::pair<iterator, bool> emplaceNode(Args&&... args);
+    template<typename K, typename... Args>
+    std::pair<iterator, bool> tryEmplaceNode(K&& key, Args&&... args);
+    template<typename K, typename M>
+    std::pair<iterator, bool> insertOrAssignNode(K&& key, M&& obj);
+    template<typename K, typename M>
+    iterator insertOrAssignNear(const_iterator hint, K&& key, M&& obj);
+    template<typename K, typename M>
+    std::pair<iterator, bool> assignOrLink(Node<Key, Value>* existing, Node<Key, Value>* parent,
+                                           bool goLeft, K&& key, M&& obj);
 
 		void totalDeletion(Node<Key, Value>* node);
+    virtual void destroyNode(Node<Key, Value>* node);
+
+    // Bulk-load helpers. Nodes come from createNode; afterBuild is told
+    // each built node's child heights and afterLoad runs once at the end,
+    // so a derived tree builds its own node type and fills in its own
+    // bookkeeping.
+    template<typename FwdIter>
+    Node<Key, Value>* buildSubtree(FwdIter& it, size_t n, int& height);
+    virtual void afterBuild(Node<Key, Value>* node, int leftHeight, int rightHeight);
+    virtual void afterLoad();
 
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    Alloc alloc_;
+    Compare comp_;
+    Node<Key, Value>* leftmost_;  // smallest node, or null when empty
+    Node<Key, Value>* rightmost_; // largest node, or null when empty
+    size_t unbalanced_;           // plain BST nodes flagged unbalanced
+    bool heightsStale_;           // some plain BST node has a stale height
 };
 
 /*
@@ -266,23 +650,40 @@ Begin implementations for the BinarySearchTree::iterator class.
 */
 
 /**
-* Explicit constructor that initializes an iterator with a given node pointer.
+* Explicit constructor that initializes an iterator with a given node pointer
+* and the tree it belongs to (needed to step back from end()).
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr) : current_(ptr) {}
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::basic_iterator(
+    Node<Key,Value> *ptr, const BinarySearchTree<Key, Value, Alloc, Compare>* tree) :
+    current_(ptr), tree_(tree) {}
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() : current_(NULL){}
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::basic_iterator() :
+    current_(NULL), tree_(NULL) {}
+
+/**
+* Converts an iterator into a const_iterator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+template<typename OtherItemT, typename>
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::basic_iterator(
+    const basic_iterator<OtherItemT>& other) :
+    current_(other.current_), tree_(other.tree_) {}
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+ItemT&
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator*() const
 {
     return current_->getItem();
 }
@@ -290,9 +691,10 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
-std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+ItemT*
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator->() const
 {
     return &(current_->getItem());
 }
@@ -301,12 +703,12 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator==(
+    const basic_iterator& rhs) const
 {
-    // TODO
     return current_ == rhs.current_;
 }
 
@@ -314,33 +716,74 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator!=(
+    const basic_iterator& rhs) const
 {
-    // TODO
     return current_ != rhs.current_;
 }
 
 
 /**
-* Advances the iterator's location using an in-order sequencing
+* Advances the iterator's location using an in-order sequencing.
+* A full traversal follows each edge twice, so steps are O(1) amortized.
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::template basic_iterator<ItemT>&
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator++()
 {
-    // TODO
     if (current_ == nullptr) {
         throw std::out_of_range("Incrementing end iterator");
     }
 
-    Node<Key, Value>* successor = BinarySearchTree<Key, Value>::predecessor(current_);
-    current_ = successor;
+    current_ = BinarySearchTree<Key, Value, Alloc, Compare>::successor(current_);
     return *this;
 }
 
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::template basic_iterator<ItemT>
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator++(int)
+{
+    basic_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back one item in key order. Decrementing end()
+* moves to the largest item.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::template basic_iterator<ItemT>&
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator--()
+{
+    if (current_ == nullptr) {
+        if (tree_ == nullptr || tree_->empty()) {
+            throw std::out_of_range("Decrementing iterator of an empty tree");
+        }
+        current_ = tree_->getLargestNode();
+    }
+    else {
+        current_ = BinarySearchTree<Key, Value, Alloc, Compare>::predecessor(current_);
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename ItemT>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::template basic_iterator<ItemT>
+BinarySearchTree<Key, Value, Alloc, Compare>::basic_iterator<ItemT>::operator--(int)
+{
+    basic_iterator old(*this);
+    --(*this);
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -357,11 +800,30 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() : root_(nullptr) {}
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree() : root_(nullptr), alloc_(), comp_(), leftmost_(nullptr), rightmost_(nullptr), unbalanced_(0), heightsStale_(false) {}
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor for a tree ordered by the given comparator.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree(const Compare& comp) :
+    root_(nullptr), alloc_(), comp_(comp), leftmost_(nullptr), rightmost_(nullptr), unbalanced_(0), heightsStale_(false) {}
+
+/**
+* Builds a height-balanced tree from the items in [first, last) in O(n)
+* when the range is already sorted by key. See bulkLoad.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename FwdIter>
+BinarySearchTree<Key, Value, Alloc, Compare>::BinarySearchTree(FwdIter first, FwdIter last) :
+    root_(nullptr), alloc_(), comp_(), leftmost_(nullptr), rightmost_(nullptr), unbalanced_(0), heightsStale_(false)
+{
+    bulkLoad(first, last);
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+BinarySearchTree<Key, Value, Alloc, Compare>::~BinarySearchTree()
 {
     clear();
 }
@@ -369,66 +831,233 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Alloc, class Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::print() const
 {
     printRoot(root_);
 }
 
+/**
+* Returns the tree's node allocation policy.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+Alloc& BinarySearchTree<Key, Value, Alloc, Compare>::getAllocator()
+{
+    return alloc_;
+}
+
+/**
+* Returns the comparator that orders the keys.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+const Compare& BinarySearchTree<Key, Value, Alloc, Compare>::key_comp() const
+{
+    return comp_;
+}
+
+/**
+* Returns true iff a orders before b. Either side may be a Key or, with a
+* transparent Compare, a heterogeneous probe; see HeterogeneousKey.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename A, typename B>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::keyLess(const A& a, const B& b) const
+{
+    return comp_(a, b);
+}
+
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Alloc, Compare>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Alloc, Compare>::iterator end(NULL, this);
     return end;
 }
 
+/**
+* const_iterator versions of begin() and end()
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns a reverse iterator to the "largest" item in the tree
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+/**
+* Returns the reverse iterator one before the "smallest" item
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
+/**
+* Returns an iterator to the smallest item, or end() if the tree is empty.
+* The smallest and largest nodes are cached, so this and max() are O(1).
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::min() const
+{
+    return iterator(leftmost_, this);
+}
+
+/**
+* Returns an iterator to the largest item, or end() if the tree is empty.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::max() const
+{
+    return iterator(rightmost_, this);
+}
+
+/**
+* Wraps a node of this tree in an iterator, for derived trees
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::makeIterator(Node<Key, Value>* node) const
+{
+    return iterator(node, this);
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Alloc, Compare>::iterator it(curr, this);
     return it;
 }
 
+/**
+* Returns an iterator to the first item whose key is not less than k,
+* or the end iterator if there is none
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(const Key & k) const
+{
+    return iterator(internalLowerBound(k), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than k,
+* or the end iterator if there is none
+*/
+template<class Key, class Value, class Alloc, class Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(const Key & k) const
+{
+    return iterator(internalUpperBound(k), this);
+}
+
+/**
+* Returns the range of items whose key equals k, which holds at most one
+* item since keys are unique
+*/
+template<class Key, class Value, class Alloc, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator>
+BinarySearchTree<Key, Value, Alloc, Compare>::equal_range(const Key & k) const
+{
+    Node<Key, Value>* first = internalLowerBound(k);
+    Node<Key, Value>* last = first;
+    if(first != nullptr && !keyLess(k, first->getKey())) {
+        last = successor(first);
+    }
+    return std::make_pair(iterator(first, this), iterator(last, this));
+}
+
+/**
+* Calls fn(item) for every item with lo <= key <= hi, in key order.
+* It descends once to the first key in range and then steps through
+* successors, so subtrees outside the range are never entered and a scan
+* costs O(log n + k) on a balanced tree.
+*/
+template<class Key, class Value, class Alloc, class Compare>
+template<typename Visitor>
+void BinarySearchTree<Key, Value, Alloc, Compare>::forEachInRange(const Key& lo, const Key& hi, Visitor fn) const
+{
+    Node<Key, Value>* curr = internalLowerBound(lo);
+    while(curr != nullptr && !keyLess(hi, curr->getKey())) {
+        fn(curr->getItem());
+        curr = successor(curr);
+    }
+}
+
 /**
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Alloc, class Compare>
+Value& BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const Key& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Alloc, class Compare>
+Value const & BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const Key& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
@@ -436,54 +1065,492 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Heterogeneous versions of find, lower_bound, upper_bound and operator[];
+* see HeterogeneousKey.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair) {
-	//TODO
-    if (root_ == nullptr) {
-      root_ = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, nullptr);
-      return;
-    }
-
-    Node<Key, Value>* current = root_;
-    Node<Key, Value>* parent = nullptr;
-
-    while (current != nullptr) {
-			parent = current;
-			if (keyValuePair.first < current->getKey()) {
-					current = current->getLeft();
-			} else if (keyValuePair.first > current->getKey()) {
-					current = current->getRight();
-			} else {
-					current->setValue(keyValuePair.second);
-					return;
-			}
-    }
-
-    if (keyValuePair.first < parent->getKey()) {
-      parent->setLeft(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-    } 
-		
-		else {
-      parent->setRight(new Node<Key, Value>(keyValuePair.first, keyValuePair.second, parent));
-    }
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::find(const K & k) const
+{
+    return iterator(internalFind(k), this);
 }
 
-/**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
-*/
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key) {
-		//TODO
-    Node<Key, Value>* targetNode = internalFind(key);
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::lower_bound(const K & k) const
+{
+    return iterator(internalLowerBound(k), this);
+}
 
-    if (targetNode == nullptr) return;
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::upper_bound(const K & k) const
+{
+    return iterator(internalUpperBound(k), this);
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename>
+Value& BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const K& key)
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+template<class Key, class Value, class Alloc, class Compare>
+template<typename K, typename>
+Value const & BinarySearchTree<Key, Value, Alloc, Compare>::operator[](const K& key) const
+{
+    Node<Key, Value> *curr = internalFind(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::insert(const std::pair<const Key, Value> &keyValuePair) {
+    insertOrAssignNode(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Inserts or overwrites like insert(const std::pair&), but moves the key
+* and value out of an rvalue pair.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename P, typename>
+void BinarySearchTree<Key, Value, Alloc, Compare>::insert(P&& keyValuePair)
+{
+    insertOrAssignNode(std::forward<P>(keyValuePair).first, std::forward<P>(keyValuePair).second);
+}
+
+/**
+* Builds an item from args inside a new node and links it in unless its
+* key is already present, in which case the new node is thrown away and
+* the existing item is left alone. Returns the item with that key and
+* whether it was inserted.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::emplace(Args&&... args)
+{
+    return emplaceNode(std::forward<Args>(args)...);
+}
+
+/**
+* Inserts key with a value built from args if key is absent. Nothing is
+* constructed, and args are not moved from, when key is already present.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    return tryEmplaceNode(key, std::forward<Args>(args)...);
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    return tryEmplaceNode(std::move(key), std::forward<Args>(args)...);
+}
+
+/**
+* Assigns obj to the value at key, or inserts key with a value built from
+* obj. The bool is true when a node was inserted.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insert_or_assign(const Key& key, M&& obj)
+{
+    return insertOrAssignNode(key, std::forward<M>(obj));
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insert_or_assign(Key&& key, M&& obj)
+{
+    return insertOrAssignNode(std::move(key), std::forward<M>(obj));
+}
+
+/**
+* Inserts or overwrites like insert, starting the search at hint rather
+* than the root. Returns the item with the key.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::insert(const_iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    return insertOrAssignNear(hint, keyValuePair.first, keyValuePair.second);
+}
+
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename P, typename>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::insert(const_iterator hint, P&& keyValuePair)
+{
+    return insertOrAssignNear(hint, std::forward<P>(keyValuePair).first, std::forward<P>(keyValuePair).second);
+}
+
+/**
+* Walks down from the root with one comparison per level. Returns the node
+* whose key is equivalent to key, if any; otherwise returns null and sets
+* parent and goLeft to where a node with that key belongs (parent is null
+* for an empty tree).
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::findSlot(
+    const K& key, Node<Key, Value>*& parent, bool& goLeft) const
+{
+    Node<Key, Value>* current = root_;
+    Node<Key, Value>* candidate = nullptr; // deepest node with key <= new key
+    parent = nullptr;
+    goLeft = false;
+
+    while (current != nullptr) {
+        parent = current;
+        goLeft = keyLess(key, current->getKey());
+        if (goLeft) {
+            current = current->getLeft();
+        } else {
+            candidate = current;
+            current = current->getRight();
+        }
+    }
+
+    if (candidate != nullptr && !keyLess(candidate->getKey(), key)) {
+        return candidate;
+    }
+    return nullptr;
+}
+
+/**
+* findSlot for a key expected to sit just before hint (std::map's rule).
+* If key falls between hint's predecessor and hint, the new node goes in
+* the empty child slot between them, found in amortized O(1) steps; a key
+* equal to hint's is found at hint itself. Anything else falls back to a
+* full descent.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::findSlotNear(
+    const_iterator hint, const K& key, Node<Key, Value>*& parent, bool& goLeft) const
+{
+    Node<Key, Value>* next = hint.current_;
+    parent = nullptr;
+    goLeft = false;
+    if (next != nullptr && !keyLess(key, next->getKey())) {
+        if (!keyLess(next->getKey(), key)) {
+            return next;
+        }
+        return findSlot(key, parent, goLeft);
+    }
+
+    // With an end() hint prev is the cached largest node, so appending a
+    // new maximum skips the descent altogether
+    Node<Key, Value>* prev = (next == nullptr) ? rightmost_ : predecessor(next);
+    if (prev != nullptr && !keyLess(prev->getKey(), key)) {
+        return findSlot(key, parent, goLeft);
+    }
+
+    // prev < key < next, so one of the two has a free slot facing the other
+    if (next != nullptr && next->getLeft() == nullptr) {
+        parent = next;
+        goLeft = true;
+    }
+    else {
+        parent = prev;
+        goLeft = false;
+    }
+    return nullptr;
+}
+
+/**
+* Hangs a new node under parent (or makes it the root) and lets the tree
+* restore its invariants.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::linkNode(
+    Node<Key, Value>* node, Node<Key, Value>* parent, bool goLeft)
+{
+    node->setParent(parent);
+    if (parent == leftmost_ && (goLeft || parent == nullptr)) {
+      leftmost_ = node;
+    }
+    if (parent == rightmost_ && !goLeft) {
+        rightmost_ = node;
+    }
+    if (parent == nullptr) {
+        root_ = node;
+    }
+    else if (goLeft) {
+        parent->setLeft(node);
+    }
+    else {
+        parent->setRight(node);
+    }
+    afterInsert(node);
+}
+
+/**
+* Called once a new node is linked in. A plain BST only marks the cached
+* heights above it stale; isBalanced brings them up to date.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::afterInsert(Node<Key, Value>* node)
+{
+    markStale(node->getParent());
+}
+
+/**
+* Allocates a node of the tree's type with its item built by source. This
+* is the one place a plain BST picks its node type; derived trees override
+* it along with destroyNode.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::createNode(ItemSource<Key, Value>& source)
+{
+    return alloc_.template create<HeightNode<Key, Value> >(source, static_cast<HeightNode<Key, Value>*>(nullptr));
+}
+
+/**
+* The body of emplace. The key is only known once the item is built, so
+* the node is created first and freed again if the key turns out to be
+* present.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::emplaceNode(Args&&... args)
+{
+    auto source = itemFrom<Key, Value>([&]() {
+        return std::pair<const Key, Value>(std::forward<Args>(args)...);
+    });
+    Node<Key, Value>* node = createNode(source);
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(node->getKey(), parent, goLeft);
+    if (existing != nullptr) {
+        destroyNode(node);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    linkNode(node, parent, goLeft);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* The body of both try_emplace overloads.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K, typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::tryEmplaceNode(K&& key, Args&&... args)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(key, parent, goLeft);
+    if (existing != nullptr) {
+        return std::make_pair(iterator(existing, this), false);
+    }
+    auto source = itemFrom<Key, Value>([&]() {
+        return std::pair<const Key, Value>(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+    });
+    Node<Key, Value>* node = createNode(source);
+    linkNode(node, parent, goLeft);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* The body of insert_or_assign, which insert is built on too.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::insertOrAssignNode(K&& key, M&& obj)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlot(key, parent, goLeft);
+    return assignOrLink(existing, parent, goLeft, std::forward<K>(key), std::forward<M>(obj));
+}
+
+/**
+* The body of both hinted inserts.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K, typename M>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::insertOrAssignNear(const_iterator hint, K&& key, M&& obj)
+{
+    Node<Key, Value>* parent;
+    bool goLeft;
+    Node<Key, Value>* existing = findSlotNear(hint, key, parent, goLeft);
+    return assignOrLink(existing, parent, goLeft, std::forward<K>(key), std::forward<M>(obj)).first;
+}
+
+/**
+* Finishes an insert_or_assign once the slot is known: assigns obj to an
+* existing node, or links in a new node built from key and obj.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K, typename M>
+std::pair<typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Alloc, Compare>::assignOrLink(
+    Node<Key, Value>* existing, Node<Key, Value>* parent, bool goLeft, K&& key, M&& obj)
+{
+    if (existing != nullptr) {
+        existing->getValue() = std::forward<M>(obj);
+        return std::make_pair(iterator(existing, this), false);
+    }
+    auto source = itemFrom<Key, Value>([&]() {
+        return std::pair<const Key, Value>(std::forward<K>(key), std::forward<M>(obj));
+    });
+    Node<Key, Value>* node = createNode(source);
+    linkNode(node, parent, goLeft);
+    return std::make_pair(iterator(node, this), true);
+}
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::remove(const Key& key) {
+    Node<Key, Value>* targetNode = internalFind(key);
+
+    if (targetNode == nullptr) return;
+
+    removeNode(targetNode);
+}
+
+/**
+* Heterogeneous version of remove; see HeterogeneousKey.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K, typename>
+void BinarySearchTree<Key, Value, Alloc, Compare>::remove(const K& key) {
+    Node<Key, Value>* targetNode = internalFind(key);
+
+    if (targetNode == nullptr) return;
+
+    removeNode(targetNode);
+}
+
+/**
+* Removes the item at pos and returns an iterator to the item after it.
+* The node is unlinked directly, so unlike remove there is no second
+* descent from the root. Throws std::out_of_range if pos is end().
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::erase(const_iterator pos)
+{
+    Node<Key, Value>* target = pos.current_;
+    if (target == nullptr) {
+        throw std::out_of_range("Erasing end iterator");
+    }
+    Node<Key, Value>* next = successor(target);
+    removeNode(target);
+    return iterator(next, this);
+}
+
+/**
+* Removes the items in [first, last) and returns last. Derived trees may
+* restructure in bulk instead of removing one node at a time; see
+* eraseRange.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+typename BinarySearchTree<Key, Value, Alloc, Compare>::iterator
+BinarySearchTree<Key, Value, Alloc, Compare>::erase(const_iterator first, const_iterator last)
+{
+    if (first != last) {
+        eraseRange(first.current_, last.current_);
+    }
+    return iterator(last.current_, this);
+}
+
+/**
+* Removes the nodes from first up to, not including, last (null meaning
+* the end). Without rebalancing, each removal only costs the walk to the
+* node's neighbour, so O(k + h) in all.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::eraseRange(Node<Key, Value>* first, Node<Key, Value>* last)
+{
+    while (first != last) {
+        Node<Key, Value>* next = successor(first);
+        removeNode(first);
+        first = next;
+    }
+}
+
+/**
+* Removes the smallest item and returns it, for using the tree as a
+* priority queue. The node comes from the leftmost_ cache, so the only
+* logarithmic work is the rebalance after the unlink.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+std::pair<Key, Value> BinarySearchTree<Key, Value, Alloc, Compare>::popMin()
+{
+    if (leftmost_ == nullptr) {
+        throw std::out_of_range("popMin on an empty tree");
+    }
+    Node<Key, Value>* target = leftmost_;
+    std::pair<Key, Value> item(target->getKey(), std::move(target->getValue()));
+    removeNode(target);
+    return item;
+}
+
+/**
+* Removes the largest item and returns it; see popMin.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+std::pair<Key, Value> BinarySearchTree<Key, Value, Alloc, Compare>::popMax()
+{
+    if (rightmost_ == nullptr) {
+        throw std::out_of_range("popMax on an empty tree");
+    }
+    Node<Key, Value>* target = rightmost_;
+    std::pair<Key, Value> item(target->getKey(), std::move(target->getValue()));
+    removeNode(target);
+    return item;
+}
+
+/**
+* Unlinks a node that is known to be in the tree and deallocates it.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::removeNode(Node<Key, Value>* targetNode) {
+    if (targetNode == leftmost_) {
+        leftmost_ = successor(targetNode);
+    }
+    if (targetNode == rightmost_) {
+        rightmost_ = predecessor(targetNode);
+    }
+
+    HeightNode<Key, Value>* target = static_cast<HeightNode<Key, Value>*>(targetNode);
+    if (target->isUnbalanced()) {
+        --unbalanced_;
+    }
+    // Lowest node whose subtree changes; heights are marked stale from there
+    Node<Key, Value>* changed = targetNode->getParent();
 
     // If the target node has no left child
     if (targetNode->getLeft() == nullptr) {
@@ -500,6 +1567,20 @@ void BinarySearchTree<Key, Value>::remove(const Key& key) {
         // Find the predecessor node
         Node<Key, Value>* predecessorNode = predecessor(targetNode);
 
+        // The predecessor takes over the target's place, so it starts from
+        // the target's cached state and is marked stale like any other node
+        HeightNode<Key, Value>* moved = static_cast<HeightNode<Key, Value>*>(predecessorNode);
+        if (moved->isUnbalanced()) {
+            --unbalanced_;
+        }
+        changed = predecessorNode == targetNode->getLeft() ? predecessorNode : predecessorNode->getParent();
+        moved->setHeight(target->getHeight());
+        moved->setUnbalanced(target->isUnbalanced());
+        moved->setStale(target->isStale());
+        if (target->isUnbalanced()) {
+            ++unbalanced_;
+        }
+
         // If the predecessor is not the left child of the target node
         if (predecessorNode != targetNode->getLeft()) {
             // Replace the predecessor with its left child
@@ -516,11 +1597,12 @@ void BinarySearchTree<Key, Value>::remove(const Key& key) {
         predecessorNode->getRight()->setParent(predecessorNode);
     }
 
-    delete targetNode; // Deallocate memory
+    destroyNode(targetNode); // Deallocate memory
+    markStale(changed);
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::transplant(Node<Key, Value>* u, Node<Key, Value>* v) {
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::transplant(Node<Key, Value>* u, Node<Key, Value>* v) {
     if (u->getParent() == nullptr) {
         root_ = v;
     } else if (u == u->getParent()->getLeft()) {
@@ -533,9 +1615,9 @@ void BinarySearchTree<Key, Value>::transplant(Node<Key, Value>* u, Node<Key, Val
     }
 }
 
-template<class Key, class Value>
+template<class Key, class Value, class Alloc, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Alloc, Compare>::predecessor(Node<Key, Value>* current)
 {
     if (current == nullptr){
         return nullptr;
@@ -565,8 +1647,8 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     return parent;
 }
 
-template<class Key, class Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current) {
+template<class Key, class Value, class Alloc, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::successor(Node<Key, Value>* current) {
     if (current == nullptr) return nullptr;
 
     // If the current node has a right subtree
@@ -592,69 +1674,310 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::successor(Node<Key, Value>* curr
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::clear()
 {
-	// TODO
-	totalDeletion(root_);
+    // A pool that frees its blocks in release() makes per-node teardown
+    // unnecessary when there are no destructors to run.
+    bool skipNodes = Alloc::BULK_RELEASE &&
+        std::is_trivially_destructible<std::pair<const Key, Value> >::value;
+    if(!skipNodes) {
+        totalDeletion(root_);
+    }
 
     root_ = nullptr;
+    leftmost_ = nullptr;
+    rightmost_ = nullptr;
+    unbalanced_ = 0;
+    heightsStale_ = false;
+    alloc_.release();
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::totalDeletion(Node<Key, Value>* node){
-	if(node == nullptr){
-		return;
-	}
+/**
+* Replaces the contents of the tree with the key/value pairs in
+* [first, last), linking the nodes directly into a height-balanced shape.
+* A range sorted by strictly increasing key is consumed in one O(n) pass;
+* otherwise it is copied and sorted first, and for duplicate keys the last
+* value wins, as with repeated insert. Nodes come from createNode and get
+* their bookkeeping from afterBuild, so a derived tree loads correctly even
+* through a base reference.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename FwdIter>
+void BinarySearchTree<Key, Value, Alloc, Compare>::bulkLoad(FwdIter first, FwdIter last)
+{
+    clear();
 
-	totalDeletion(node->getLeft());
-	totalDeletion(node->getRight());
+    bool strictlySorted = true;
+    size_t n = 0;
+    for(FwdIter prev = first, it = first; it != last; prev = it, ++it, ++n) {
+        if(it != first && !keyLess(prev->first, it->first)) {
+            strictlySorted = false;
+        }
+    }
 
-	delete node;
+    int height = 0;
+    if(strictlySorted) {
+        FwdIter it = first;
+        root_ = buildSubtree(it, n, height);
+        leftmost_ = findSmallest(root_);
+        rightmost_ = findLargest(root_);
+        afterLoad();
+        return;
+    }
 
-	return;
+    // Sort a copy, keeping equal keys in input order so the last one wins
+    std::vector<std::pair<Key, Value> > items(first, last);
+    std::stable_sort(items.begin(), items.end(),
+        [this](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+            return keyLess(a.first, b.first);
+        });
+
+    size_t unique = 0;
+    for(size_t i = 0; i < items.size(); ++i) {
+        if(unique > 0 && !keyLess(items[unique - 1].first, items[i].first)) {
+            items[unique - 1].second = items[i].second;
+        }
+        else {
+            if(unique != i) {
+                items[unique] = items[i];
+            }
+            ++unique;
+        }
+    }
+
+    typename std::vector<std::pair<Key, Value> >::const_iterator it = items.begin();
+    root_ = buildSubtree(it, unique, height);
+    leftmost_ = findSmallest(root_);
+    rightmost_ = findLargest(root_);
+    afterLoad();
+}
+
+/**
+* Builds a subtree from the next n items of a sorted sequence, consuming
+* them in order: left half, then the subtree root, then the right half.
+* Sibling subtrees differ in size by at most one, so their heights differ
+* by at most one as well.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename FwdIter>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::buildSubtree(FwdIter& it, size_t n, int& height)
+{
+    if(n == 0) {
+        height = 0;
+        return nullptr;
+    }
+
+    int leftHeight = 0;
+    int rightHeight = 0;
+    size_t leftCount = (n - 1) / 2;
+
+    Node<Key, Value>* left = buildSubtree(it, leftCount, leftHeight);
+    auto source = itemFrom<Key, Value>([&]() {
+        return std::pair<const Key, Value>(it->first, it->second);
+    });
+    Node<Key, Value>* node = createNode(source);
+    ++it;
+    Node<Key, Value>* right = buildSubtree(it, n - 1 - leftCount, rightHeight);
+
+    node->setLeft(left);
+    node->setRight(right);
+    if(left != nullptr) {
+        left->setParent(node);
+    }
+    if(right != nullptr) {
+        right->setParent(node);
+    }
+
+    afterBuild(node, leftHeight, rightHeight);
+    height = 1 + (leftHeight > rightHeight ? leftHeight : rightHeight);
+    return node;
+}
+
+/**
+* Called by bulkLoad for each node once its subtrees are linked. A plain
+* BST caches the node's height.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::afterBuild(Node<Key, Value>* node, int leftHeight, int rightHeight)
+{
+    static_cast<HeightNode<Key, Value>*>(node)->setHeight(1 + (leftHeight > rightHeight ? leftHeight : rightHeight));
+}
+
+/**
+* Called once bulkLoad has installed the new root and cached ends. A plain
+* BST has nothing more to do.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::afterLoad()
+{
+
+}
+
+/**
+* Destroys the subtree rooted at node without recursion, so that even a
+* degenerate tree with depth n is torn down in O(n) time and O(1) extra
+* space. It descends to a leaf, unlinks and destroys it, and continues
+* from the leaf's parent. The link from node's own parent is left as is.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::totalDeletion(Node<Key, Value>* node)
+{
+    if(node == nullptr) {
+        return;
+    }
+
+    Node<Key, Value>* current = node;
+    while(true) {
+        if(current->getLeft() != nullptr) {
+            current = current->getLeft();
+        }
+        else if(current->getRight() != nullptr) {
+            current = current->getRight();
+        }
+        else {
+            if(current == node) {
+                destroyNode(current);
+                return;
+            }
+
+            Node<Key, Value>* parent = current->getParent();
+            if(parent->getLeft() == current) {
+                parent->setLeft(nullptr);
+            }
+            else {
+                parent->setRight(nullptr);
+            }
+            destroyNode(current);
+            current = parent;
+        }
+    }
+}
+
+/**
+* Hands a node back to the allocator. Nodes have no virtual destructor, so
+* trees that use a derived node type override this to destroy it as that
+* type.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::destroyNode(Node<Key, Value>* node)
+{
+    alloc_.destroy(static_cast<HeightNode<Key, Value>*>(node));
 }
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Alloc, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Alloc, Compare>::getSmallestNode() const
 {
-    //TODO
-    // Start from the root
-    Node<Key, Value>* currentNode = root_;
+    return leftmost_;
+}
 
+/**
+* Returns the smallest node in the subtree at node by walking left.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc, Compare>::findSmallest(Node<Key, Value>* node)
+{
     // Traverse left until the leftmost node is found
-    while (currentNode != nullptr && currentNode->getLeft() != nullptr)
+    while (node != nullptr && node->getLeft() != nullptr)
     {
-        currentNode = currentNode->getLeft();
+        node = node->getLeft();
     }
 
-    // Return the leftmost node (smallest node)
-    return currentNode;
+    return node;
 }
 
 
+/**
+* A helper function to find the largest node in the tree.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc, Compare>::getLargestNode() const
+{
+    return rightmost_;
+}
+
+/**
+* Returns the largest node in the subtree at node by walking right.
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Alloc, Compare>::findLargest(Node<Key, Value>* node)
+{
+    while (node != nullptr && node->getRight() != nullptr)
+    {
+        node = node->getRight();
+    }
+
+    return node;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::internalFind(const K& key) const
+{
+    // Descend like lower_bound with one comparison per level, then check
+    // the candidate for equality once at the bottom.
+    Node<Key, Value>* candidate = internalLowerBound(key);
+
+    if(candidate != nullptr && !keyLess(key, candidate->getKey())){
+        return candidate;
+    }
+
+    return nullptr;
+}
+
+/**
+* Helper function returning the node with the smallest key that is not
+* less than key, or NULL if every key is smaller
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::internalLowerBound(const K& key) const
 {
-    // TODO
     Node<Key, Value>* currentNode = root_;
+    Node<Key, Value>* bound = nullptr;
 
     while(currentNode != nullptr)
     {
-        if(key == currentNode->getKey()){
-            return currentNode;
+        if(keyLess(currentNode->getKey(), key)){
+            currentNode = currentNode->getRight();
         }
 
-        else if(key < currentNode->getKey()){
+        else{
+            bound = currentNode;
+            currentNode = currentNode->getLeft();
+        }
+    }
+
+    return bound;
+}
+
+/**
+* Helper function returning the node with the smallest key that is
+* greater than key, or NULL if there is none
+*/
+template<typename Key, typename Value, typename Alloc, typename Compare>
+template<typename K>
+Node<Key, Value>* BinarySearchTree<Key, Value, Alloc, Compare>::internalUpperBound(const K& key) const
+{
+    Node<Key, Value>* currentNode = root_;
+    Node<Key, Value>* bound = nullptr;
+
+    while(currentNode != nullptr)
+    {
+        if(keyLess(key, currentNode->getKey())){
+            bound = currentNode;
             currentNode = currentNode->getLeft();
         }
 
@@ -663,45 +1986,166 @@ Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) con
         }
     }
 
-    return nullptr;
+    return bound;
 }
 
 /**
- * Return true iff the BST is balanced.
+ * Return true iff the BST is balanced. A plain BST counts the nodes whose
+ * children's heights differ by more than one, but updates only mark the
+ * heights above them stale, so this first recomputes the stale ones: the
+ * cost is proportional to the nodes touched since the last call, O(1) when
+ * nothing changed. That refresh writes the cached heights, which is why
+ * this is not const. An AVLTree never has any such nodes, since its
+ * rotations keep every node balanced. Builds with -DBST_CHECK_BALANCE
+ * check the answer against isBalancedDeep.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Alloc, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::isBalanced()
 {
-    // TODO
-    return checkBalanced(root_) != -1;
-
+    if (heightsStale_) {
+        refreshStale();
+    }
+#ifdef BST_CHECK_BALANCE
+    if ((unbalanced_ == 0) != isBalancedDeep()) {
+        throw std::logic_error("isBalanced: cached balance does not match the tree");
+    }
+#endif
+    return unbalanced_ == 0;
 }
 
-template<typename Key, typename Value>
-int BinarySearchTree<Key, Value>::checkBalanced(Node<Key, Value>* node) const {
-    if (node == nullptr) return 0;
+/**
+ * Recomputes every subtree height to decide whether the tree is balanced,
+ * ignoring anything cached. O(n); meant for tests and debugging.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+bool BinarySearchTree<Key, Value, Alloc, Compare>::isBalancedDeep() const
+{
+    return checkBalanced(root_) != -1;
+}
 
-    int leftHeight = checkBalanced(node->getLeft());
-    if (leftHeight == -1) return -1;
+/**
+ * The cached height of a plain BST subtree, 0 for an empty one.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+int BinarySearchTree<Key, Value, Alloc, Compare>::cachedHeight(Node<Key, Value>* node)
+{
+    return node ? static_cast<HeightNode<Key, Value>*>(node)->getHeight() : 0;
+}
 
-    int rightHeight = checkBalanced(node->getRight());
-    if (rightHeight == -1) return -1;
+/**
+ * Marks node and its ancestors stale after a change below node. Every
+ * ancestor of a stale node is already stale, so this stops at the first
+ * one and costs amortised O(1) per update.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::markStale(Node<Key, Value>* node)
+{
+    while (node != nullptr) {
+        HeightNode<Key, Value>* current = static_cast<HeightNode<Key, Value>*>(node);
+        if (current->isStale()) {
+            break;
+        }
+        current->setStale(true);
+        node = node->getParent();
+    }
+    heightsStale_ = true;
+}
 
-    if (abs(leftHeight - rightHeight) > 1) return -1;
+/**
+ * Recomputes the cached height and unbalanced flag of every stale node,
+ * keeping unbalanced_ in step. The stale nodes form a subtree at the root,
+ * so a post-order walk over them alone, following parent links back up,
+ * sees each node's children settled before the node itself.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::refreshStale()
+{
+    Node<Key, Value>* node = root_;
+    if (node == nullptr || !static_cast<HeightNode<Key, Value>*>(node)->isStale()) {
+        node = nullptr;
+    }
+    while (node != nullptr) {
+        HeightNode<Key, Value>* left = static_cast<HeightNode<Key, Value>*>(node->getLeft());
+        HeightNode<Key, Value>* right = static_cast<HeightNode<Key, Value>*>(node->getRight());
+        if (left != nullptr && left->isStale()) {
+            node = left;
+            continue;
+        }
+        if (right != nullptr && right->isStale()) {
+            node = right;
+            continue;
+        }
 
-    if(leftHeight > rightHeight){
-        return 1 + leftHeight;
+        HeightNode<Key, Value>* current = static_cast<HeightNode<Key, Value>*>(node);
+        int leftHeight = cachedHeight(left);
+        int rightHeight = cachedHeight(right);
+        bool unbalanced = abs(leftHeight - rightHeight) > 1;
+        if (unbalanced != current->isUnbalanced()) {
+            current->setUnbalanced(unbalanced);
+            if (unbalanced) {
+                ++unbalanced_;
+            }
+            else {
+                --unbalanced_;
+            }
+        }
+        current->setHeight(1 + (leftHeight > rightHeight ? leftHeight : rightHeight));
+        current->setStale(false);
+        node = node->getParent();
     }
+    heightsStale_ = false;
+}
+
+/**
+ * Returns the leaf depths, level widths and height of the tree, gathered
+ * in one walk.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+TreeShape BinarySearchTree<Key, Value, Alloc, Compare>::shape() const
+{
+    return profileShape(root_);
+}
 
-    else{
-        return 1 + rightHeight;
+/**
+ * Returns the height of the subtree at node, or -1 if some node in it has
+ * children whose heights differ by more than one. Walks with an explicit
+ * stack so a degenerate tree cannot overflow the call stack.
+ */
+template<typename Key, typename Value, typename Alloc, typename Compare>
+int BinarySearchTree<Key, Value, Alloc, Compare>::checkBalanced(Node<Key, Value>* node) const {
+    // Each node is pushed once to expand it and once more, after both its
+    // subtrees, to combine their heights from the top of heights
+    std::vector<std::pair<Node<Key, Value>*, bool> > stack;
+    std::vector<int> heights;
+    stack.push_back(std::make_pair(node, false));
+    while (!stack.empty()) {
+        Node<Key, Value>* current = stack.back().first;
+        bool expanded = stack.back().second;
+        stack.pop_back();
+        if (current == nullptr) {
+            heights.push_back(0);
+        }
+        else if (!expanded) {
+            stack.push_back(std::make_pair(current, true));
+            stack.push_back(std::make_pair(current->getRight(), false));
+            stack.push_back(std::make_pair(current->getLeft(), false));
+        }
+        else {
+            int rightHeight = heights.back();
+            heights.pop_back();
+            int leftHeight = heights.back();
+            heights.pop_back();
+            if (abs(leftHeight - rightHeight) > 1) return -1;
+            heights.push_back(1 + (leftHeight > rightHeight ? leftHeight : rightHeight));
+        }
     }
+    return heights.back();
 }
 
 
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Alloc, typename Compare>
+void BinarySearchTree<Key, Value, Alloc, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
@@ -781,6 +2225,18 @@ void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value
     else if(this->root_ == n2) {
         this->root_ = n1;
     }
+    if(leftmost_ == n1) {
+        leftmost_ = n2;
+    }
+    else if(leftmost_ == n2) {
+        leftmost_ = n1;
+    }
+    if(rightmost_ == n1) {
+        rightmost_ = n2;
+    }
+    else if(rightmost_ == n2) {
+        rightmost_ = n1;
+    }
 
 }
 
@@ -0,0 +1,66 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+* Loads n sorted keys into an AVLTree one insert at a time and through
+* bulkLoad, then does the same for the unbalanced BinarySearchTree (whose
+* insert loop is quadratic on sorted input, so it only gets bstN keys).
+*/
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    size_t bstN = 20000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    vector<pair<uint64_t, uint64_t> > sorted(n);
+    for(size_t i = 0; i < n; ++i) {
+        sorted[i] = make_pair(i * 2, i);
+    }
+
+    cout << fixed << setprecision(1);
+
+    {
+        AVLTree<uint64_t, uint64_t> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            tree.insert(sorted[i]);
+        }
+        cout << "AVLTree insert loop,   n=" << n << ": " << elapsedMs(start) << " ms" << endl;
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        AVLTree<uint64_t, uint64_t> tree(sorted.begin(), sorted.end());
+        cout << "AVLTree bulk load,     n=" << n << ": " << elapsedMs(start) << " ms" << endl;
+    }
+    {
+        BinarySearchTree<uint64_t, uint64_t> tree;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < bstN; ++i) {
+            tree.insert(sorted[i]);
+        }
+        cout << "BST insert loop,       n=" << bstN << ": " << elapsedMs(start) << " ms" << endl;
+    }
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        BinarySearchTree<uint64_t, uint64_t> tree(sorted.begin(), sorted.end());
+        cout << "BST bulk load,         n=" << n << ": " << elapsedMs(start) << " ms"
+             << (tree.isBalanced() ? " (balanced)" : " (unbalanced)") << endl;
+    }
+
+    return 0;
+}
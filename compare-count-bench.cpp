@@ -0,0 +1,87 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <map>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+static uint64_t comparisons = 0;
+
+/**
+ * std::less on strings that counts how many times it is called.
+ */
+struct CountingLess
+{
+    bool operator()(const string& a, const string& b) const
+    {
+        ++comparisons;
+        return a < b;
+    }
+};
+
+typedef AVLTree<string, int, NoTrace, NewNodeAllocator, NoAugment, CountingLess> CountedAVL;
+typedef map<string, int, CountingLess> CountedMap;
+
+/**
+ * Makes n random keys that share a long common prefix, so each
+ * comparison has to walk most of the string.
+ */
+vector<string> makeKeys(size_t n, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    vector<string> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = "customer/account/" + to_string(rng());
+    }
+    return keys;
+}
+
+template<typename Container>
+void countFor(const char* name, const vector<string>& keys)
+{
+    Container c;
+    comparisons = 0;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        c.insert(make_pair(keys[i], (int)i));
+    }
+    double perInsert = (double)comparisons / keys.size();
+
+    comparisons = 0;
+    size_t hits = 0;
+    for(size_t i = 0; i < keys.size(); ++i) {
+        hits += c.find(keys[i]) != c.end();
+    }
+    double perFind = (double)comparisons / keys.size();
+
+    cout << setw(10) << name << setw(10) << keys.size()
+         << setw(8) << fixed << setprecision(1) << log2((double)keys.size())
+         << setw(14) << perInsert << setw(14) << perFind
+         << (hits == keys.size() ? "" : "  (lookup failed)") << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t maxN = 1000000;
+    if(argc > 1) {
+        maxN = strtoul(argv[1], NULL, 10);
+    }
+
+    // One comparison per level plus one equality check means roughly
+    // lg n + 2 comparisons per operation.
+    cout << setw(10) << "tree" << setw(10) << "n" << setw(8) << "lg n"
+         << setw(14) << "cmp/insert" << setw(14) << "cmp/find" << endl;
+    for(size_t n = maxN / 64; n <= maxN; n *= 4) {
+        vector<string> keys = makeKeys(n, 104);
+        countFor<CountedAVL>("AVLTree", keys);
+        countFor<CountedMap>("std::map", keys);
+    }
+
+    return 0;
+}
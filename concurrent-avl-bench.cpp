@@ -0,0 +1,137 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+#include "concurrent-avl.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * The baseline: one AVLTree behind one mutex.
+ */
+class LockedTree
+{
+public:
+    bool find(uint64_t key, uint64_t& value)
+    {
+        lock_guard<mutex> guard(lock_);
+        AVLTree<uint64_t, uint64_t>::iterator it = tree_.find(key);
+        if(it == tree_.end()) {
+            return false;
+        }
+        value = it->second;
+        return true;
+    }
+
+    void insert(const pair<const uint64_t, uint64_t>& item)
+    {
+        lock_guard<mutex> guard(lock_);
+        tree_.insert_or_assign(item.first, item.second);
+    }
+
+    void remove(uint64_t key)
+    {
+        lock_guard<mutex> guard(lock_);
+        tree_.remove(key);
+    }
+
+private:
+    mutex lock_;
+    AVLTree<uint64_t, uint64_t> tree_;
+};
+
+/**
+ * Splits ops operations over threads threads on a tree holding n of the
+ * 2n keys, with writePercent of them split evenly between inserts and
+ * removes. Returns millions of operations per second.
+ */
+template<typename Tree>
+double run(Tree& t, size_t threads, size_t n, size_t ops, unsigned writePercent)
+{
+    atomic<size_t> found(0);
+    vector<thread> workers;
+    ops /= threads;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < threads; ++i) {
+        workers.push_back(thread([&t, &found, i, n, ops, writePercent]() {
+            mt19937_64 rng(i + 1);
+            size_t hits = 0;
+            uint64_t value;
+            for(size_t j = 0; j < ops; ++j) {
+                uint64_t key = rng() % (2 * n);
+                unsigned roll = rng() % 100;
+                if(roll >= writePercent) {
+                    hits += t.find(key, value);
+                }
+                else if(roll % 2 == 0) {
+                    t.insert(make_pair(key, key));
+                }
+                else {
+                    t.remove(key);
+                }
+            }
+            found.fetch_add(hits);
+        }));
+    }
+    for(size_t i = 0; i < threads; ++i) {
+        workers[i].join();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+    return threads * ops / seconds / 1e6;
+}
+
+template<typename Tree>
+void fill(Tree& t, size_t n)
+{
+    mt19937_64 rng(0);
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t key = rng() % (2 * n);
+        t.insert(make_pair(key, key));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+    const size_t ops = 4000000;
+
+    // 64 shards, each covering an equal slice of the 2n keys in use
+    vector<uint64_t> splits;
+    for(uint64_t i = 1; i < 64; ++i) {
+        splits.push_back(i * 2 * n / 64);
+    }
+
+    const size_t threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    const unsigned writePercents[] = { 5, 50 };
+    cout << "n = " << n << ", " << ops << " ops per run, "
+         << thread::hardware_concurrency() << " hardware threads (Mops/s)" << endl;
+
+    for(size_t w = 0; w < sizeof(writePercents) / sizeof(writePercents[0]); ++w) {
+        cout << endl << (100 - writePercents[w]) << "/" << writePercents[w]
+             << " read/write" << endl;
+        cout << setw(10) << "threads" << setw(14) << "one mutex" << setw(14) << "sharded" << endl;
+        for(size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i) {
+            LockedTree locked;
+            ConcurrentAVLTree<uint64_t, uint64_t> sharded(splits);
+            fill(locked, n);
+            fill(sharded, n);
+            cout << setw(10) << threadCounts[i] << fixed << setprecision(2)
+                 << setw(14) << run(locked, threadCounts[i], n, ops, writePercents[w])
+                 << setw(14) << run(sharded, threadCounts[i], n, ops, writePercents[w]) << endl;
+        }
+    }
+    return 0;
+}
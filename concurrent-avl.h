@@ -0,0 +1,355 @@
+#ifndef CONCURRENT_AVL_H
+#define CONCURRENT_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "epoch.h"
+#include "persistent-avl.h"
+
+/**
+* An ordered map that many threads can use at once. The key space is cut
+* into shards at the given split keys, so shard i holds the keys from
+* splits[i - 1] up to but not including splits[i], and walking the shards
+* in turn walks the keys in order.
+*
+* Each shard keeps a PersistentAVLTree. Writers take the shard's mutex,
+* update the tree by copying the O(log n) nodes on the path, and publish
+* the new root with one atomic store. Readers take no lock and write no
+* shared memory: they load the published root inside an EpochGuard and
+* walk nodes that never change, so they never retry or wait on a writer.
+* Replaced roots are released once no reader can still be walking them.
+*
+* Lookups copy the value out instead of returning an iterator, since an
+* iterator would outlive the guard. A scan sees each shard as of one
+* moment, but different shards as of different moments.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    explicit ConcurrentAVLTree(const std::vector<Key>& splits, const Compare& comp = Compare());
+    ~ConcurrentAVLTree();
+
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+    bool lower_bound(const Key& key, std::pair<Key, Value>& item) const;
+    template<typename F>
+    void scan(const Key& lo, const Key& hi, F visit) const;
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    size_t size() const;
+    void clear();
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&) = delete;
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&) = delete;
+
+    typedef PersistentAVLTree<Key, Value, Compare> Tree;
+    typedef typename Tree::NodeType NodeType;
+
+    // Replaced roots are kept until this many pile up in a shard
+    static const size_t RECLAIM_BATCH = 32;
+
+    struct Shard
+    {
+        explicit Shard(const Compare& comp) : root(nullptr), tree(comp) {}
+
+        std::atomic<const NodeType*> root; // the version readers see
+        std::mutex lock;                   // serialises writers
+        Tree tree;                         // the writers' version
+        std::vector<std::pair<const NodeType*, uint64_t> > retired; // root, retire epoch
+        char padding[64];                  // keeps shards off each other's cache lines
+    };
+
+    size_t shardIndex(const Key& key) const;
+    void publish(Shard& shard);
+    static void reclaim(Shard& shard);
+
+    std::vector<Key> splits_;
+    std::vector<std::unique_ptr<Shard> > shards_;
+    Compare comp_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  ----------------------------------------------------
+*/
+
+/**
+* Builds an empty tree with one more shard than there are splits. There
+* must be at least one split, since a single shard would serialise every
+* writer, and they must be strictly increasing. Writers to different
+* shards never contend, so the splits should cut the expected keys into
+* even parts. Throws std::invalid_argument otherwise.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const std::vector<Key>& splits, const Compare& comp) :
+    splits_(splits),
+    comp_(comp)
+{
+    if(splits_.empty()) {
+        throw std::invalid_argument("ConcurrentAVLTree: at least one split is required");
+    }
+    for(size_t i = 1; i < splits_.size(); ++i) {
+        if(!comp_(splits_[i - 1], splits_[i])) {
+            throw std::invalid_argument("ConcurrentAVLTree: splits must be strictly increasing");
+        }
+    }
+    for(size_t i = 0; i <= splits_.size(); ++i) {
+        shards_.push_back(std::unique_ptr<Shard>(new Shard(comp_)));
+    }
+}
+
+/**
+* No other thread may be using the tree by now, so every retired root can
+* go at once.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    for(size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        Tree::release(shard.root.load());
+        for(size_t j = 0; j < shard.retired.size(); ++j) {
+            Tree::release(shard.retired[j].first);
+        }
+    }
+}
+
+/**
+* Copies the value for key into value and returns true, or returns false
+* if key is absent.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    EpochGuard guard;
+    const NodeType* node = shards_[shardIndex(key)]->root.load();
+    while(node != nullptr) {
+        if(comp_(key, node->item.first)) {
+            node = node->left;
+        }
+        else if(comp_(node->item.first, key)) {
+            node = node->right;
+        }
+        else {
+            value = node->item.second;
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    EpochGuard guard;
+    const NodeType* node = shards_[shardIndex(key)]->root.load();
+    while(node != nullptr) {
+        if(comp_(key, node->item.first)) {
+            node = node->left;
+        }
+        else if(comp_(node->item.first, key)) {
+            node = node->right;
+        }
+        else {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Copies out the item with the smallest key not less than key and returns
+* true, or returns false if every key is less. Moves on to later shards
+* when key's own shard has nothing at or above it.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::lower_bound(const Key& key, std::pair<Key, Value>& item) const
+{
+    EpochGuard guard;
+    for(size_t i = shardIndex(key); i < shards_.size(); ++i) {
+        const NodeType* bound = nullptr;
+        const NodeType* node = shards_[i]->root.load();
+        while(node != nullptr) {
+            if(comp_(node->item.first, key)) {
+                node = node->right;
+            }
+            else {
+                bound = node;
+                node = node->left;
+            }
+        }
+        if(bound != nullptr) {
+            item = bound->item;
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Calls visit on each item with a key from lo up to but not including hi,
+* in key order. visit runs inside an EpochGuard, so a slow visit delays
+* the release of replaced nodes; it may call the tree's lookups.
+*/
+template<class Key, class Value, class Compare>
+template<typename F>
+void ConcurrentAVLTree<Key, Value, Compare>::scan(const Key& lo, const Key& hi, F visit) const
+{
+    if(!comp_(lo, hi)) {
+        return;
+    }
+    size_t last = shardIndex(hi);
+    std::vector<const NodeType*> pending;
+    EpochGuard guard;
+    for(size_t i = shardIndex(lo); i <= last && i < shards_.size(); ++i) {
+        // Stack the path down to lo; each stacked node is at least lo and
+        // the nodes left to visit come out of the stack in order
+        const NodeType* node = shards_[i]->root.load();
+        while(node != nullptr) {
+            if(comp_(node->item.first, lo)) {
+                node = node->right;
+            }
+            else {
+                pending.push_back(node);
+                node = node->left;
+            }
+        }
+        while(!pending.empty()) {
+            node = pending.back();
+            pending.pop_back();
+            if(!comp_(node->item.first, hi)) {
+                pending.clear();
+                return;
+            }
+            visit(node->item);
+            for(node = node->right; node != nullptr; node = node->left) {
+                pending.push_back(node);
+            }
+        }
+    }
+}
+
+/**
+* Inserts the pair, or overwrites the value if the key is present.
+* Returns true if a new key was added.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Shard& shard = *shards_[shardIndex(keyValuePair.first)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    bool added = shard.tree.insert(keyValuePair);
+    publish(shard);
+    return added;
+}
+
+/**
+* Removes key and returns true, or returns false if it was absent.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Shard& shard = *shards_[shardIndex(key)];
+    std::lock_guard<std::mutex> guard(shard.lock);
+    if(!shard.tree.remove(key)) {
+        return false;
+    }
+    publish(shard);
+    return true;
+}
+
+/**
+* Returns the number of keys, read from each shard's root. Shards are read
+* one at a time, so with concurrent writers this is not a point-in-time
+* figure.
+*/
+template<class Key, class Value, class Compare>
+size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    EpochGuard guard;
+    size_t total = 0;
+    for(size_t i = 0; i < shards_.size(); ++i) {
+        const NodeType* root = shards_[i]->root.load();
+        if(root != nullptr) {
+            total += root->size;
+        }
+    }
+    return total;
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::clear()
+{
+    for(size_t i = 0; i < shards_.size(); ++i) {
+        Shard& shard = *shards_[i];
+        std::lock_guard<std::mutex> guard(shard.lock);
+        shard.tree.clear();
+        publish(shard);
+    }
+}
+
+template<class Key, class Value, class Compare>
+size_t ConcurrentAVLTree<Key, Value, Compare>::shardIndex(const Key& key) const
+{
+    return std::upper_bound(splits_.begin(), splits_.end(), key, comp_) - splits_.begin();
+}
+
+/**
+* Makes the writers' version of shard the one readers see, and retires the
+* root it replaces. Called with the shard's lock held.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::publish(Shard& shard)
+{
+    shard.retired.reserve(shard.retired.size() + 1);
+    const NodeType* old = shard.root.exchange(Tree::retain(shard.tree.root_));
+    if(old == nullptr) {
+        return;
+    }
+    shard.retired.push_back(std::make_pair(old, EpochDomain::instance().current()));
+    if(shard.retired.size() >= RECLAIM_BATCH) {
+        reclaim(shard);
+    }
+}
+
+/**
+* Starts a new epoch and releases the retired roots no reader can still
+* hold. Nodes a root shares with newer versions stay alive through their
+* reference counts.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::reclaim(Shard& shard)
+{
+    EpochDomain& domain = EpochDomain::instance();
+    domain.advance();
+    uint64_t oldest = domain.oldestActive();
+    size_t kept = 0;
+    for(size_t i = 0; i < shard.retired.size(); ++i) {
+        if(shard.retired[i].second < oldest) {
+            Tree::release(shard.retired[i].first);
+        }
+        else {
+            shard.retired[kept++] = shard.retired[i];
+        }
+    }
+    shard.retired.resize(kept);
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  --------------------------------------------------
+*/
+
+#endif
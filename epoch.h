@@ -0,0 +1,210 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstdint>
+
+/**
+* Epoch-based reclamation for readers that walk shared nodes without
+* locking. A reader brackets its walk with an EpochGuard, which only writes
+* the calling thread's own slot: the epoch it entered in. A writer that
+* unlinks nodes notes current() as their retire epoch, and may free them
+* once every reader still inside entered in a later epoch, which
+* oldestActive() reports after an advance().
+*
+* There is one domain per process. Slots are never freed; a thread's slot
+* goes back to the pool when the thread exits.
+*/
+class EpochDomain
+{
+public:
+    static EpochDomain& instance();
+
+    void enter();
+    void leave();
+    uint64_t current() const;
+    void advance();
+    uint64_t oldestActive() const;
+
+private:
+    EpochDomain();
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    struct Slot
+    {
+        Slot() : epoch(0), inUse(true), depth(0), next(nullptr) {}
+
+        std::atomic<uint64_t> epoch; // 0 while the thread is outside
+        std::atomic<bool> inUse;
+        unsigned depth;              // nested guards; owner thread only
+        Slot* next;
+        char padding[64];            // keeps slots off each other's cache lines
+    };
+
+    // Holds a thread's slot and hands it back when the thread exits
+    struct SlotHandle
+    {
+        explicit SlotHandle(EpochDomain& domain);
+        ~SlotHandle();
+
+        Slot* slot;
+    };
+
+    Slot& mySlot();
+    Slot* acquireSlot();
+
+    std::atomic<uint64_t> epoch_;
+    std::atomic<Slot*> slots_;
+};
+
+/**
+* Marks the calling thread as reading shared nodes for its lifetime.
+* Guards nest.
+*/
+class EpochGuard
+{
+public:
+    EpochGuard();
+    ~EpochGuard();
+
+private:
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+};
+
+/*
+  ----------------------------------------------
+  Begin implementations for the EpochDomain class.
+  ----------------------------------------------
+*/
+
+/**
+* The process-wide domain. It is never destroyed, so threads that exit
+* after main returns can still hand back their slots.
+*/
+inline EpochDomain& EpochDomain::instance()
+{
+    static EpochDomain* domain = new EpochDomain();
+    return *domain;
+}
+
+inline EpochDomain::EpochDomain() :
+    epoch_(1),
+    slots_(nullptr)
+{
+
+}
+
+/**
+* Publishes the current epoch in the calling thread's slot. The store is
+* sequentially consistent, so a writer that replaces a root and then
+* scans the slots either sees this reader or is seen replacing the root.
+*/
+inline void EpochDomain::enter()
+{
+    Slot& slot = mySlot();
+    if(slot.depth++ == 0) {
+        slot.epoch.store(epoch_.load(std::memory_order_acquire));
+    }
+}
+
+inline void EpochDomain::leave()
+{
+    Slot& slot = mySlot();
+    if(--slot.depth == 0) {
+        slot.epoch.store(0, std::memory_order_release);
+    }
+}
+
+/**
+* The epoch to tag nodes with once they are unlinked. Readers that entered
+* in it or earlier may still hold them.
+*/
+inline uint64_t EpochDomain::current() const
+{
+    return epoch_.load();
+}
+
+inline void EpochDomain::advance()
+{
+    epoch_.fetch_add(1);
+}
+
+/**
+* The earliest epoch a reader still inside entered in, or UINT64_MAX when
+* there is none. Nodes retired in an earlier epoch are unreachable.
+*/
+inline uint64_t EpochDomain::oldestActive() const
+{
+    uint64_t oldest = UINT64_MAX;
+    for(Slot* slot = slots_.load(); slot != nullptr; slot = slot->next) {
+        uint64_t epoch = slot->epoch.load();
+        if(epoch != 0 && epoch < oldest) {
+            oldest = epoch;
+        }
+    }
+    return oldest;
+}
+
+inline EpochDomain::Slot& EpochDomain::mySlot()
+{
+    static thread_local SlotHandle handle(*this);
+    return *handle.slot;
+}
+
+/**
+* Takes a slot some exited thread gave back, or links in a new one.
+*/
+inline EpochDomain::Slot* EpochDomain::acquireSlot()
+{
+    for(Slot* slot = slots_.load(); slot != nullptr; slot = slot->next) {
+        bool free = false;
+        if(!slot->inUse.load(std::memory_order_relaxed) &&
+           slot->inUse.compare_exchange_strong(free, true)) {
+            return slot;
+        }
+    }
+    Slot* slot = new Slot();
+    slot->next = slots_.load(std::memory_order_relaxed);
+    while(!slots_.compare_exchange_weak(slot->next, slot)) {
+    }
+    return slot;
+}
+
+inline EpochDomain::SlotHandle::SlotHandle(EpochDomain& domain) :
+    slot(domain.acquireSlot())
+{
+
+}
+
+inline EpochDomain::SlotHandle::~SlotHandle()
+{
+    slot->depth = 0;
+    slot->epoch.store(0, std::memory_order_release);
+    slot->inUse.store(false, std::memory_order_release);
+}
+
+/*
+  ----------------------------------------------
+  Begin implementations for the EpochGuard class.
+  ----------------------------------------------
+*/
+
+inline EpochGuard::EpochGuard()
+{
+    EpochDomain::instance().enter();
+}
+
+inline EpochGuard::~EpochGuard()
+{
+    EpochDomain::instance().leave();
+}
+
+/*
+  --------------------------------------------
+  End implementations for the EpochGuard class.
+  --------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,132 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "equal-paths.h"
+#include "equal-paths-iterative.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * The old equalPaths: a full height pass, then a second pass comparing
+ * each leaf against it.
+ */
+int findHeight(Node* tree)
+{
+    if(tree == nullptr) {
+        return 0;
+    }
+    return 1 + max(findHeight(tree->left), findHeight(tree->right));
+}
+
+bool leavesAt(Node* node, int height, int maxHeight)
+{
+    if(node == nullptr) {
+        return true;
+    }
+    if(node->left == nullptr && node->right == nullptr) {
+        return height == maxHeight;
+    }
+    return leavesAt(node->left, height + 1, maxHeight) && leavesAt(node->right, height + 1, maxHeight);
+}
+
+bool twoPass(Node* root)
+{
+    return root == nullptr || leavesAt(root, 1, findHeight(root));
+}
+
+/**
+ * Links nodes into a complete tree in heap order: node i has children
+ * 2i + 1 and 2i + 2. With 2^k - 1 nodes every leaf is on the last level.
+ */
+Node* linkComplete(vector<Node>& nodes)
+{
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        size_t l = 2 * i + 1;
+        nodes[i].left = l < nodes.size() ? &nodes[l] : nullptr;
+        nodes[i].right = l + 1 < nodes.size() ? &nodes[l + 1] : nullptr;
+    }
+    return &nodes[0];
+}
+
+/**
+ * Links nodes into a chain of left children, which has one leaf.
+ */
+Node* linkChain(vector<Node>& nodes)
+{
+    for(size_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].left = i + 1 < nodes.size() ? &nodes[i + 1] : nullptr;
+        nodes[i].right = nullptr;
+    }
+    return &nodes[0];
+}
+
+double timeCheck(bool (*check)(Node*), Node* root, bool& result)
+{
+    Clock::time_point start = Clock::now();
+    result = check(root);
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 10000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+    size_t perfect = 1;
+    while(2 * perfect + 1 <= n) {
+        perfect = 2 * perfect + 1;
+    }
+
+    vector<Node> nodes;
+    nodes.reserve(n);
+    for(size_t i = 0; i < n; ++i) {
+        nodes.push_back(Node(static_cast<int>(i)));
+    }
+
+    // "early miss" is the perfect tree with one more node hung under its
+    // first leaf, so the second leaf reached already disagrees
+    const char* names[] = { "perfect", "complete", "early miss", "chain" };
+    const size_t counts[] = { perfect, n, perfect, n };
+    bool (*const checks[])(Node*) = { twoPass, equalPaths, equalPathsIterative, equalPathsMorris };
+
+    cout << "n = " << n << " (perfect tree: " << perfect << " nodes), ms" << endl;
+    cout << setw(12) << "tree" << setw(12) << "two-pass" << setw(12) << "recursive"
+         << setw(12) << "stack" << setw(12) << "morris" << setw(8) << "equal" << endl;
+    for(int shape = 0; shape < 4; ++shape) {
+        vector<Node> part(nodes.begin(), nodes.begin() + counts[shape]);
+        Node* root;
+        if(shape == 3) {
+            root = linkChain(part);
+        }
+        else if(shape == 2) {
+            root = linkComplete(part);
+            Node* first = root;
+            while(first->left != nullptr) {
+                first = first->left;
+            }
+            nodes[perfect].left = nodes[perfect].right = nullptr;
+            first->left = &nodes[perfect];
+        }
+        else {
+            root = linkComplete(part);
+        }
+
+        cout << setw(12) << names[shape] << fixed << setprecision(1);
+        bool result = false;
+        for(int c = 0; c < 4; ++c) {
+            // The recursive versions would need a stack frame per node
+            if(shape == 3 && c < 2) {
+                cout << setw(12) << "-";
+                continue;
+            }
+            cout << setw(12) << timeCheck(checks[c], root, result);
+        }
+        cout << setw(8) << (result ? "yes" : "no") << endl;
+    }
+    return 0;
+}
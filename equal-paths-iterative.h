@@ -0,0 +1,115 @@
+#ifndef EQUAL_PATHS_ITERATIVE_H
+#define EQUAL_PATHS_ITERATIVE_H
+
+#include <utility>
+#include <vector>
+#include "equal-paths.h"
+
+// Variants of equalPaths that do not recurse, for trees too deep for the
+// call stack. Like equalPaths they make one pass, and the first leaf fixes
+// the depth that the others must match.
+
+/**
+ * Walks the tree depth-first with an explicit stack of (node, depth)
+ * pairs and returns at the first leaf whose depth differs. The stack lives
+ * on the heap and never holds more than depth + 1 entries.
+ */
+inline bool equalPathsIterative(Node* root)
+{
+	std::vector<std::pair<Node*, int> > pending;
+	if(root != nullptr){
+		pending.push_back(std::make_pair(root, 0));
+	}
+
+	int leafDepth = -1;
+	while(!pending.empty()){
+		Node* node = pending.back().first;
+		int depth = pending.back().second;
+		pending.pop_back();
+
+		if(node->left == nullptr && node->right == nullptr){
+			if(leafDepth < 0){
+				leafDepth = depth;
+			}
+			else if(depth != leafDepth){
+				return false;
+			}
+			continue;
+		}
+		if(node->right != nullptr){
+			pending.push_back(std::make_pair(node->right, depth + 1));
+		}
+		if(node->left != nullptr){
+			pending.push_back(std::make_pair(node->left, depth + 1));
+		}
+	}
+	return true;
+}
+
+/**
+ * A Morris traversal that uses O(1) extra space. While walking, it points
+ * the empty right link of each in-order predecessor back at its successor,
+ * and it removes every such thread before returning, so the tree is
+ * unchanged afterwards but must not be read by anyone else meanwhile.
+ *
+ * Every leaf except the largest is the in-order predecessor of some node,
+ * so leaves are checked when their thread is made; the largest leaf is the
+ * only node with both links empty during the walk. Following a thread
+ * back up climbs the steps counted on the way to the predecessor, which is
+ * how the depth is kept. After a mismatch the walk stops descending into
+ * unvisited left subtrees and only follows links back up to remove the
+ * threads it has made.
+ */
+inline bool equalPathsMorris(Node* root)
+{
+	bool equal = true;
+	int leafDepth = -1;
+	int depth = 0;
+	Node* curr = root;
+	while(curr != nullptr){
+		if(curr->left == nullptr){
+			if(curr->right == nullptr && equal){
+				if(leafDepth < 0){
+					leafDepth = depth;
+				}
+				equal = depth == leafDepth;
+			}
+			curr = curr->right;
+			++depth;
+			continue;
+		}
+
+		Node* pred = curr->left;
+		int steps = 1;
+		while(pred->right != nullptr && pred->right != curr){
+			pred = pred->right;
+			++steps;
+		}
+
+		if(pred->right == nullptr){
+			if(!equal){
+				curr = curr->right;
+				continue;
+			}
+			if(pred->left == nullptr){
+				if(leafDepth < 0){
+					leafDepth = depth + steps;
+				}
+				equal = depth + steps == leafDepth;
+			}
+			pred->right = curr;
+			curr = curr->left;
+			++depth;
+		}
+		else{
+			// Came back up the thread from pred, one step past its depth
+			pred->right = nullptr;
+			depth -= steps + 1;
+			curr = curr->right;
+			++depth;
+		}
+	}
+	return equal;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdlib>
+#include "equal-paths.h"
+#include "thread-pool.h"
+#include "equal-paths-parallel.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * Links the first count nodes into a complete tree in heap order. With
+ * 2^k - 1 nodes it is perfect, so every leaf is on the last level.
+ */
+Node* linkComplete(vector<Node>& nodes, size_t count)
+{
+    for(size_t i = 0; i < count; ++i) {
+        size_t l = 2 * i + 1;
+        nodes[i].left = l < count ? &nodes[l] : nullptr;
+        nodes[i].right = l + 1 < count ? &nodes[l + 1] : nullptr;
+    }
+    return &nodes[0];
+}
+
+double msSince(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 100000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+    size_t perfect = 1;
+    while(2 * perfect + 1 <= n) {
+        perfect = 2 * perfect + 1;
+    }
+
+    vector<Node> nodes;
+    nodes.reserve(n);
+    for(size_t i = 0; i < n; ++i) {
+        nodes.push_back(Node(static_cast<int>(i)));
+    }
+
+    // Both trees pass, so every run walks every node
+    cout << "equal paths on a perfect tree of " << perfect << " nodes, balance on a complete tree of "
+         << n << " nodes, " << thread::hardware_concurrency() << " hardware threads" << endl;
+    cout << "(ms; speedup over the serial walk)" << endl;
+    cout << setw(10) << "threads" << setw(20) << "equal paths" << setw(20) << "balanced" << endl;
+
+    WorkStealingPool single(1);
+    Node* root = linkComplete(nodes, perfect);
+    Clock::time_point start = Clock::now();
+    bool ok = equalPaths(root);
+    double pathsBase = msSince(start);
+    root = linkComplete(nodes, n);
+    start = Clock::now();
+    ok = isBalancedParallel(root, single, 0) && ok;
+    double balanceBase = msSince(start);
+    cout << setw(10) << "serial" << fixed << setprecision(1)
+         << setw(12) << pathsBase << setw(8) << "" << setw(12) << balanceBase << endl;
+
+    const size_t threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    for(size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i) {
+        WorkStealingPool pool(threadCounts[i]);
+        root = linkComplete(nodes, perfect);
+        start = Clock::now();
+        ok = equalPathsParallel(root, pool) && ok;
+        double paths = msSince(start);
+        root = linkComplete(nodes, n);
+        start = Clock::now();
+        ok = isBalancedParallel(root, pool) && ok;
+        double balance = msSince(start);
+        cout << setw(10) << threadCounts[i]
+             << setw(12) << paths << setw(7) << pathsBase / paths << "x"
+             << setw(12) << balance << setw(7) << balanceBase / balance << "x" << endl;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,177 @@
+#ifndef EQUAL_PATHS_PARALLEL_H
+#define EQUAL_PATHS_PARALLEL_H
+
+#include <atomic>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+#include "equal-paths.h"
+#include "fork-levels.h"
+#include "tree-shape.h"
+
+// Parallel validators for large trees of equal-paths Nodes. The top
+// forkLevels levels of the tree are split into left and right tasks with
+// pool.invoke, so there are up to 2^forkLevels subtrees, each walked
+// serially without recursion. A Node carries no subtree size, so the cutoff
+// is a depth rather than a node count. The default of forkLevels comes from
+// forkLevelsFor in fork-levels.h. Pool is WorkStealingPool from
+// thread-pool.h or anything else with invoke(f, g) and size(). Once any
+// task finds a violation, the others stop at their next node.
+
+/**
+ * Folds the depth of each leaf under node into [minDepth, maxDepth] with
+ * walkLeaves. Gives up as soon as the range is wider than one depth or
+ * failed is set.
+ */
+inline void serialLeafDepthRange(Node* node, int depth, int& minDepth, int& maxDepth,
+                                 std::atomic<bool>& failed)
+{
+	int lo = minDepth, hi = maxDepth;
+	walkLeaves(node, depth,
+		[](int) {},
+		[&](int leafDepth) {
+			if(lo < 0 || leafDepth < lo){
+				lo = leafDepth;
+			}
+			if(leafDepth > hi){
+				hi = leafDepth;
+			}
+			if(lo != hi){
+				failed.store(true, std::memory_order_relaxed);
+				return false;
+			}
+			return !failed.load(std::memory_order_relaxed);
+		});
+	minDepth = lo;
+	maxDepth = hi;
+}
+
+/**
+ * Forks the top forkLevels levels under node and merges the leaf depth
+ * ranges of both sides. minDepth is -1 while no leaf has been seen.
+ */
+template<typename Pool>
+void parallelLeafDepthRange(Node* node, int depth, int forkLevels, Pool& pool,
+                            int& minDepth, int& maxDepth, std::atomic<bool>& failed)
+{
+	if(node == nullptr){
+		return;
+	}
+	if(forkLevels == 0 || node->left == nullptr || node->right == nullptr){
+		serialLeafDepthRange(node, depth, minDepth, maxDepth, failed);
+		return;
+	}
+
+	int leftMin = -1, leftMax = -1, rightMin = -1, rightMax = -1;
+	pool.invoke(
+		[&]() { parallelLeafDepthRange(node->left, depth + 1, forkLevels - 1, pool, leftMin, leftMax, failed); },
+		[&]() { parallelLeafDepthRange(node->right, depth + 1, forkLevels - 1, pool, rightMin, rightMax, failed); });
+	if(leftMin != rightMin || leftMax != rightMax){
+		failed.store(true, std::memory_order_relaxed);
+	}
+	minDepth = leftMin;
+	maxDepth = leftMax;
+}
+
+/**
+ * Returns the height of the subtree at node, or -1 if some node in it has
+ * subtrees whose heights differ by more than one. Walks in post-order with
+ * an explicit stack; heights holds the finished heights of the children
+ * whose parents are still on the stack.
+ */
+inline int serialBalancedHeight(Node* node, std::atomic<bool>& failed)
+{
+	std::vector<std::pair<Node*, bool> > pending; // second: children done
+	std::vector<int> heights;
+	pending.push_back(std::make_pair(node, false));
+	while(!pending.empty()){
+		if(failed.load(std::memory_order_relaxed)){
+			return -1;
+		}
+		node = pending.back().first;
+		if(!pending.back().second){
+			pending.back().second = true;
+			if(node->right != nullptr){
+				pending.push_back(std::make_pair(node->right, false));
+			}
+			if(node->left != nullptr){
+				pending.push_back(std::make_pair(node->left, false));
+			}
+			continue;
+		}
+		pending.pop_back();
+
+		int hr = 0, hl = 0;
+		if(node->right != nullptr){
+			hr = heights.back();
+			heights.pop_back();
+		}
+		if(node->left != nullptr){
+			hl = heights.back();
+			heights.pop_back();
+		}
+		if(std::abs(hl - hr) > 1){
+			failed.store(true, std::memory_order_relaxed);
+			return -1;
+		}
+		heights.push_back(1 + (hl > hr ? hl : hr));
+	}
+	return heights.back();
+}
+
+template<typename Pool>
+int parallelBalancedHeight(Node* node, int forkLevels, Pool& pool, std::atomic<bool>& failed)
+{
+	if(node == nullptr){
+		return 0;
+	}
+	if(forkLevels == 0 || node->left == nullptr || node->right == nullptr){
+		return serialBalancedHeight(node, failed);
+	}
+
+	int hl = 0, hr = 0;
+	pool.invoke(
+		[&]() { hl = parallelBalancedHeight(node->left, forkLevels - 1, pool, failed); },
+		[&]() { hr = parallelBalancedHeight(node->right, forkLevels - 1, pool, failed); });
+	if(hl < 0 || hr < 0 || std::abs(hl - hr) > 1){
+		failed.store(true, std::memory_order_relaxed);
+		return -1;
+	}
+	return 1 + (hl > hr ? hl : hr);
+}
+
+/**
+ * equalPaths, split over pool. Pass forkLevels to override the default
+ * fork depth; 0 runs the whole walk on the calling thread.
+ */
+template<typename Pool>
+bool equalPathsParallel(Node* root, Pool& pool, int forkLevels = -1)
+{
+	if(root == nullptr){
+		return true;
+	}
+	if(forkLevels < 0){
+		forkLevels = forkLevelsFor(pool.size());
+	}
+	std::atomic<bool> failed(false);
+	int minDepth = -1, maxDepth = -1;
+	parallelLeafDepthRange(root, 0, forkLevels, pool, minDepth, maxDepth, failed);
+	return !failed.load();
+}
+
+/**
+ * Returns true if the subtree heights of every node differ by at most
+ * one, splitting the walk over pool like equalPathsParallel.
+ */
+template<typename Pool>
+bool isBalancedParallel(Node* root, Pool& pool, int forkLevels = -1)
+{
+	if(forkLevels < 0){
+		forkLevels = forkLevelsFor(pool.size());
+	}
+	std::atomic<bool> failed(false);
+	parallelBalancedHeight(root, forkLevels, pool, failed);
+	return !failed.load();
+}
+
+#endif
@@ -1,6 +1,14 @@
-#include <iostream>
 #include <cstdlib>
+#include <random>
+#include <vector>
 #include "equal-paths.h"
+#include "equal-paths-iterative.h"
+#include "equal-paths-parallel.h"
+#include "thread-pool.h"
+#include "tree-shape.h"
+
+#include <gtest/gtest.h>
+
 using namespace std;
 
 
@@ -8,8 +16,6 @@ Node* a;
 Node* b;
 Node* c;
 Node* d;
-Node* e;
-Node* f;
 
 void setNode(Node* n, int key, Node* left=NULL, Node* right=NULL)
 {
@@ -18,59 +24,356 @@ void setNode(Node* n, int key, Node* left=NULL, Node* right=NULL)
   n->right = right;
 }
 
-void test1(const char* msg)
+// All three variants must agree with the expected answer
+void expectEqualPaths(Node* root, bool expected)
+{
+  EXPECT_EQ(equalPaths(root), expected);
+  EXPECT_EQ(equalPathsIterative(root), expected);
+  EXPECT_EQ(equalPathsMorris(root), expected);
+}
+
+class EqualPaths : public testing::Test
+{
+protected:
+  void SetUp()
+  {
+    a = new Node(1);
+    b = new Node(2);
+    c = new Node(3);
+    d = new Node(4);
+  }
+
+  void TearDown()
+  {
+    delete a;
+    delete b;
+    delete c;
+    delete d;
+  }
+};
+
+TEST_F(EqualPaths, Test1)
 {
   setNode(a,1,NULL, NULL);
-  cout << msg << ": " <<   equalPaths(a) << endl;
+  expectEqualPaths(a, true);
 }
 
-void test2(const char* msg)
+TEST_F(EqualPaths, Test2)
 {
   setNode(a,1,b,NULL);
   setNode(b,2,NULL,NULL);
-  cout << msg << ": " <<   equalPaths(a) << endl;
+  expectEqualPaths(a, true);
 }
 
-void test3(const char* msg)
+TEST_F(EqualPaths, Test3)
 {
   setNode(a,1,b,c);
   setNode(b,2,NULL,NULL);
   setNode(c,3,NULL,NULL);
-  cout << msg << ": " <<   equalPaths(a) << endl;
+  expectEqualPaths(a, true);
 }
 
-void test4(const char* msg)
+TEST_F(EqualPaths, Test4)
 {
   setNode(a,1,NULL,c);
   setNode(c,3,NULL,NULL);
-  cout << msg << ": " <<   equalPaths(a) << endl;
+  expectEqualPaths(a, true);
 }
 
-void test5(const char* msg)
+TEST_F(EqualPaths, Test5)
 {
   setNode(a,1,b,c);
   setNode(b,2,NULL,d);
   setNode(c,3,NULL,NULL);
   setNode(d,4,NULL,NULL);
-  cout << msg << ": " <<   equalPaths(a) << endl;
+  expectEqualPaths(a, false);
 }
 
-int main()
+TEST(EqualPathsVariants, EmptyTree)
 {
-  a = new Node(1);
-  b = new Node(2);
-  c = new Node(3);
-  d = new Node(4);
+  expectEqualPaths(NULL, true);
+}
+
+// Builds a random tree up to height levels tall; nodes are kept in owned
+Node* randomTree(mt19937& rng, int height, vector<Node*>& owned)
+{
+  if(height == 0 || rng() % 5 == 0){
+    return NULL;
+  }
+  Node* n = new Node(owned.size());
+  owned.push_back(n);
+  n->left = randomTree(rng, height - 1, owned);
+  n->right = randomTree(rng, height - 1, owned);
+  return n;
+}
 
-  test1("Test1");
-  test2("Test2");
-  test3("Test3");
-  test4("Test4");
-  test5("Test5");
- 
-  delete a;
-  delete b;
-  delete c;
-  delete d;
+// A perfect tree of the given height; nodes are kept in owned
+Node* perfectTree(int height, vector<Node*>& owned)
+{
+  if(height == 0){
+    return NULL;
+  }
+  Node* n = new Node(owned.size());
+  owned.push_back(n);
+  n->left = perfectTree(height - 1, owned);
+  n->right = perfectTree(height - 1, owned);
+  return n;
+}
+
+// Records every node's links, to check that a walk left the tree as it was
+vector<pair<Node*, Node*> > links(const vector<Node*>& owned)
+{
+  vector<pair<Node*, Node*> > result;
+  for(size_t i = 0; i < owned.size(); ++i){
+    result.push_back(make_pair(owned[i]->left, owned[i]->right));
+  }
+  return result;
 }
 
+TEST(EqualPathsVariants, MatchRecursiveOnRandomTrees)
+{
+  mt19937 rng(3);
+  int equal = 0;
+  for(int round = 0; round < 3000; ++round){
+    vector<Node*> owned;
+    Node* root;
+    if(round % 3 == 0){
+      // Perfect trees, half of them with one extra leaf
+      root = perfectTree(1 + rng() % 10, owned);
+      if(rng() % 2){
+        Node* n = root;
+        while(n->left != NULL){
+          n = n->left;
+        }
+        n->left = new Node(-1);
+        owned.push_back(n->left);
+      }
+    }
+    else{
+      root = randomTree(rng, 1 + rng() % 10, owned);
+    }
+
+    vector<pair<Node*, Node*> > before = links(owned);
+    bool expected = equalPaths(root);
+    equal += expected;
+    EXPECT_EQ(equalPathsIterative(root), expected);
+    EXPECT_EQ(equalPathsMorris(root), expected);
+    EXPECT_EQ(links(owned), before);
+
+    for(size_t i = 0; i < owned.size(); ++i){
+      delete owned[i];
+    }
+  }
+  // Both answers must be well represented
+  EXPECT_GT(equal, 300);
+  EXPECT_LT(equal, 2700);
+}
+
+TEST(EqualPathsVariants, DeepChainDoesNotRecurse)
+{
+  // A left chain a million nodes deep, then one extra leaf beside its end
+  const int depth = 1000000;
+  vector<Node*> owned;
+  Node* root = new Node(0);
+  owned.push_back(root);
+  Node* n = root;
+  for(int i = 1; i < depth; ++i){
+    n->left = new Node(i);
+    n = n->left;
+    owned.push_back(n);
+  }
+  EXPECT_TRUE(equalPathsIterative(root));
+  EXPECT_TRUE(equalPathsMorris(root));
+
+  owned[depth - 3]->right = new Node(-1);
+  owned.push_back(owned[depth - 3]->right);
+  vector<pair<Node*, Node*> > before = links(owned);
+  EXPECT_FALSE(equalPathsIterative(root));
+  EXPECT_FALSE(equalPathsMorris(root));
+  EXPECT_EQ(links(owned), before);
+
+  for(size_t i = 0; i < owned.size(); ++i){
+    delete owned[i];
+  }
+}
+
+// Height of the tree at n, or -1 if some node's sides differ by more than one
+int balancedHeight(Node* n)
+{
+  if(n == NULL){
+    return 0;
+  }
+  int hl = balancedHeight(n->left);
+  int hr = balancedHeight(n->right);
+  if(hl < 0 || hr < 0 || abs(hl - hr) > 1){
+    return -1;
+  }
+  return 1 + max(hl, hr);
+}
+
+// The sparsest balanced tree of the given height; nodes are kept in owned
+Node* fibonacciTree(int height, vector<Node*>& owned)
+{
+  if(height <= 0){
+    return NULL;
+  }
+  Node* n = new Node(owned.size());
+  owned.push_back(n);
+  n->left = fibonacciTree(height - 1, owned);
+  n->right = fibonacciTree(height - 2, owned);
+  return n;
+}
+
+TEST(EqualPathsParallel, MatchSerialOnRandomTrees)
+{
+  // Fork depths from none at all to deeper than most of the trees
+  WorkStealingPool pool(3);
+  const int forkLevels[] = { 0, 1, 3, 12, -1 };
+  mt19937 rng(4);
+  int balanced = 0;
+  for(int round = 0; round < 600; ++round){
+    vector<Node*> owned;
+    Node* root;
+    if(round % 3 == 0){
+      root = perfectTree(1 + rng() % 14, owned);
+      // Half get one extra leaf, which breaks equal paths but not balance
+      if(rng() % 2){
+        Node* n = root;
+        for(int i = rng() % 4; i > 0 && n->right != NULL; --i){
+          n = n->right;
+        }
+        while(n->left != NULL){
+          n = n->left;
+        }
+        n->left = new Node(-1);
+        owned.push_back(n->left);
+      }
+    }
+    else if(round % 3 == 1){
+      root = fibonacciTree(1 + rng() % 18, owned);
+    }
+    else{
+      root = randomTree(rng, 1 + rng() % 12, owned);
+    }
+
+    bool equal = equalPaths(root);
+    bool isBalanced = balancedHeight(root) >= 0;
+    balanced += isBalanced;
+    for(size_t f = 0; f < sizeof(forkLevels) / sizeof(forkLevels[0]); ++f){
+      EXPECT_EQ(equalPathsParallel(root, pool, forkLevels[f]), equal) << round << " " << forkLevels[f];
+      EXPECT_EQ(isBalancedParallel(root, pool, forkLevels[f]), isBalanced) << round << " " << forkLevels[f];
+    }
+
+    for(size_t i = 0; i < owned.size(); ++i){
+      delete owned[i];
+    }
+  }
+  // Both answers must be well represented
+  EXPECT_GT(balanced, 200);
+  EXPECT_LT(balanced, 500);
+}
+
+TEST(EqualPathsParallel, EmptyTreeAndDeepChain)
+{
+  WorkStealingPool pool(2);
+  EXPECT_TRUE(equalPathsParallel(NULL, pool));
+  EXPECT_TRUE(isBalancedParallel(NULL, pool));
+
+  // Below the fork levels both walks are iterative, so a million-deep
+  // chain must not overflow the stack
+  const int depth = 1000000;
+  vector<Node*> owned;
+  Node* root = new Node(0);
+  owned.push_back(root);
+  Node* n = root;
+  for(int i = 1; i < depth; ++i){
+    n->left = new Node(i);
+    n = n->left;
+    owned.push_back(n);
+  }
+  EXPECT_TRUE(equalPathsParallel(root, pool));
+  EXPECT_FALSE(isBalancedParallel(root, pool));
+
+  for(size_t i = 0; i < owned.size(); ++i){
+    delete owned[i];
+  }
+}
+
+TEST(EqualPathsParallel, ForkLevelsGrowWithThePool)
+{
+  EXPECT_EQ(forkLevelsFor(1), 4);
+  EXPECT_EQ(forkLevelsFor(2), 5);
+  EXPECT_EQ(forkLevelsFor(4), 6);
+  EXPECT_EQ(forkLevelsFor(5), 7);
+  EXPECT_EQ(forkLevelsFor(32), 9);
+}
+
+TEST_F(EqualPaths, ProfileShape)
+{
+  // The Test5 tree: a leaf at depth 1 and one at depth 2
+  setNode(a,1,b,c);
+  setNode(b,2,NULL,d);
+  setNode(c,3,NULL,NULL);
+  setNode(d,4,NULL,NULL);
+  TreeShape shape = profileShape(a);
+  EXPECT_EQ(shape.nodes, 4u);
+  EXPECT_EQ(shape.leaves, 2u);
+  EXPECT_EQ(shape.height, 3);
+  EXPECT_EQ(shape.minLeafDepth, 1);
+  EXPECT_EQ(shape.maxLeafDepth, 2);
+  EXPECT_EQ(shape.leafDepths, (vector<size_t>{ 0, 1, 1 }));
+  EXPECT_EQ(shape.levelWidths, (vector<size_t>{ 1, 2, 1 }));
+  EXPECT_FALSE(shape.equalPaths());
+
+  shape = profileShape<Node>(NULL);
+  EXPECT_EQ(shape.nodes, 0u);
+  EXPECT_EQ(shape.height, 0);
+  EXPECT_TRUE(shape.equalPaths());
+}
+
+TEST(TreeShape, AgreesWithEqualPaths)
+{
+  mt19937 rng(6);
+  for(int round = 0; round < 1000; ++round){
+    vector<Node*> owned;
+    Node* root = randomTree(rng, 1 + rng() % 10, owned);
+    TreeShape shape = profileShape(root);
+    EXPECT_EQ(shape.equalPaths(), equalPaths(root));
+    EXPECT_EQ(shape.nodes, owned.size());
+    EXPECT_LE(shape.leaves, shape.nodes);
+    for(size_t i = 0; i < owned.size(); ++i){
+      delete owned[i];
+    }
+  }
+}
+
+TEST(WalkLeaves, VisitsLeavesLeftToRightAndStopsEarly)
+{
+  // Leaves at depths 3, 2, 3 and 1, left to right
+  vector<Node*> owned;
+  for(int i = 0; i < 7; ++i){
+    owned.push_back(new Node(i));
+  }
+  setNode(owned[0], 0, owned[1], owned[2]);
+  setNode(owned[1], 1, owned[3], owned[4]);
+  setNode(owned[3], 3, owned[5], owned[6]);
+
+  vector<int> nodeDepths;
+  vector<int> leafDepths;
+  walkLeaves(owned[0], 0,
+    [&nodeDepths](int depth) { nodeDepths.push_back(depth); },
+    [&leafDepths](int depth) { leafDepths.push_back(depth); return true; });
+  EXPECT_EQ(leafDepths, (vector<int>{ 3, 3, 2, 1 }));
+  EXPECT_EQ(nodeDepths.size(), 7u);
+
+  // Stopping at the second leaf leaves the rest unvisited
+  leafDepths.clear();
+  walkLeaves(owned[0], 10,
+    [](int) {},
+    [&leafDepths](int depth) { leafDepths.push_back(depth); return leafDepths.size() < 2; });
+  EXPECT_EQ(leafDepths, (vector<int>{ 13, 13 }));
+
+  for(size_t i = 0; i < owned.size(); ++i){
+    delete owned[i];
+  }
+}
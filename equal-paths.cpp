@@ -9,48 +9,28 @@ using namespace std;
 
 // You may add any prototypes of helper functions here
 // Helper function prototypes
-int findHeight(Node* subtree);
-bool equalLengthPaths(Node* node, int height, int maxHeight);
+bool equalLengthPaths(Node* node, int depth, int& leafDepth);
 
+// One pass: the first leaf reached fixes the depth that every other leaf
+// must match, so the walk stops at the first leaf that does not.
 bool equalPaths(Node* root) {
-	if(root == nullptr){
-		return true;
-	}
-	
-	int maxHeight = findHeight(root);
-
-	return equalLengthPaths(root, 1, maxHeight);
-}
-
-int findHeight(Node* tree)
-{
-	if(tree == nullptr)
-	{
-		return 0;
-	}
-
-	int leftHeight = findHeight(tree->left);
-	int rightHeight = findHeight(tree->right);
-
-	if(leftHeight > rightHeight){
-		return 1 + leftHeight;
-	}
-
-	else{
-		return 1 + rightHeight;
-	}
+	int leafDepth = -1;
+	return equalLengthPaths(root, 0, leafDepth);
 }
 
-bool equalLengthPaths(Node* node, int height, int maxHeight)
+bool equalLengthPaths(Node* node, int depth, int& leafDepth)
 {
 	if (node == nullptr){
 		return true;
 	}
 
 	if (node->right == nullptr && node->left == nullptr){
-		return height == maxHeight;
+		if (leafDepth < 0){
+			leafDepth = depth;
+		}
+		return depth == leafDepth;
 	}
 
-	return equalLengthPaths(node->left, height+1, maxHeight) 
-	&& equalLengthPaths(node->right, height+1, maxHeight);
+	return equalLengthPaths(node->left, depth+1, leafDepth) 
+	&& equalLengthPaths(node->right, depth+1, leafDepth);
 }
\ No newline at end of file
@@ -0,0 +1,23 @@
+#ifndef FORK_LEVELS_H
+#define FORK_LEVELS_H
+
+#include <cstddef>
+
+/**
+* The number of tree levels a fork-join walk should split into tasks on a
+* pool of the given size. It gives about 16 subtrees per thread, enough for
+* stealing to even out lopsided trees without drowning the walk in tasks.
+* Kept apart from thread-pool.h so walks templated on their pool need not
+* pull in any threading headers.
+*/
+inline int forkLevelsFor(size_t threads)
+{
+    int levels = 4;
+    while(threads > 1) {
+        threads = (threads + 1) / 2;
+        ++levels;
+    }
+    return levels;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * Makes n increasing timestamps where each one is swapped with a nearby
+ * neighbour with probability jitter, like a slightly out-of-order feed.
+ */
+vector<uint64_t> makeStream(size_t n, double jitter, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> coin(0.0, 1.0);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = 1000 * (i + 1);
+    }
+    for(size_t i = 1; i < n; ++i) {
+        if(coin(rng) < jitter) {
+            swap(keys[i], keys[i - 1]);
+        }
+    }
+    return keys;
+}
+
+double nsSince(Clock::time_point start, size_t n)
+{
+    return chrono::duration<double, nano>(Clock::now() - start).count() / n;
+}
+
+/**
+ * Times plain insert, insert with end() as the hint, and insert with the
+ * previously inserted item's successor as the hint.
+ */
+template<typename Tree>
+void timeTree(const char* name, const vector<uint64_t>& keys)
+{
+    size_t n = keys.size();
+    cout << setw(10) << name << fixed << setprecision(1);
+    {
+        Tree t;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            t.insert(make_pair(keys[i], keys[i]));
+        }
+        cout << setw(12) << nsSince(start, n);
+    }
+    {
+        Tree t;
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            t.insert(t.end(), make_pair(keys[i], keys[i]));
+        }
+        cout << setw(12) << nsSince(start, n);
+    }
+    {
+        Tree t;
+        typename Tree::iterator hint = t.end();
+        Clock::time_point start = Clock::now();
+        for(size_t i = 0; i < n; ++i) {
+            hint = t.insert(hint, make_pair(keys[i], keys[i]));
+            ++hint;
+        }
+        cout << setw(12) << nsSince(start, n) << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    const double jitters[] = { 0.0, 0.01, 0.1 };
+    for(size_t j = 0; j < sizeof(jitters) / sizeof(jitters[0]); ++j) {
+        vector<uint64_t> keys = makeStream(n, jitters[j], 104);
+        cout << "n = " << n << ", jitter = " << setprecision(2) << jitters[j] << " (ns/insert)" << endl;
+        cout << setw(10) << "tree" << setw(12) << "insert" << setw(12) << "hint end"
+             << setw(12) << "hint next" << endl;
+        timeTree<AVLTree<uint64_t, uint64_t> >("AVLTree", keys);
+        timeTree<map<uint64_t, uint64_t> >("std::map", keys);
+        cout << endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+/**
+* Returns the ns per element of a full in-order walk over [first, last),
+* taking the best of a few passes.
+*/
+template<typename Iter>
+double timeTraversal(Iter first, Iter last, size_t n, uint64_t& sink)
+{
+    double best = 0;
+    for(int pass = 0; pass < 5; ++pass) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(Iter it = first; it != last; ++it) {
+            sink += it->second;
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        if(pass == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best / n;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t maxN = 1000000;
+    if(argc > 1) {
+        maxN = strtoul(argv[1], NULL, 10);
+    }
+
+    // If stepping is O(1) amortized, ns/element stays roughly flat as n grows
+    // (apart from cache effects, which std::map shares).
+    cout << setw(10) << "n" << setw(16) << "AVLTree ns/el" << setw(16) << "std::map ns/el" << endl;
+    uint64_t sink = 0;
+    for(size_t n = maxN / 16; n <= maxN; n *= 2) {
+        mt19937_64 rng(104);
+        AVLTree<uint64_t, uint64_t> tree;
+        map<uint64_t, uint64_t> reference;
+        for(size_t i = 0; i < n; ++i) {
+            uint64_t key = rng();
+            tree.insert(std::make_pair(key, i));
+            reference.insert(std::make_pair(key, i));
+        }
+
+        double treeNs = timeTraversal(tree.cbegin(), tree.cend(), n, sink);
+        double mapNs = timeTraversal(reference.cbegin(), reference.cend(), n, sink);
+        cout << setw(10) << n << fixed << setprecision(2)
+             << setw(16) << treeNs << setw(16) << mapNs << endl;
+    }
+    cout << "(" << sink % 10 << ")" << endl;
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+typedef AVLTree<uint64_t, uint64_t> NewTree;
+typedef AVLTree<uint64_t, uint64_t, NoTrace, PoolNodeAllocator<> > PoolTree;
+
+double elapsedMs(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/**
+* Runs the same insert / find / remove-half / refill / clear workload on
+* a tree and prints the time spent in each phase.
+*/
+template<typename Tree>
+void runWorkload(const char* name, const vector<uint64_t>& keys)
+{
+    Tree tree;
+    uint64_t sum = 0;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    double insertMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); ++i) {
+        sum += tree.find(keys[i])->second;
+    }
+    double findMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        tree.remove(keys[i]);
+    }
+    for(size_t i = 0; i < keys.size(); i += 2) {
+        tree.insert(std::make_pair(keys[i], i));
+    }
+    double churnMs = elapsedMs(start);
+
+    start = chrono::steady_clock::now();
+    tree.clear();
+    double clearMs = elapsedMs(start);
+
+    cout << setw(8) << name << fixed << setprecision(1)
+         << setw(12) << insertMs << setw(12) << findMs
+         << setw(12) << churnMs << setw(12) << clearMs
+         << "   (" << sum % 10 << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    mt19937_64 rng(104);
+    vector<uint64_t> keys(n);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng();
+    }
+
+    cout << n << " random uint64_t keys, " << sizeof(AVLNode<uint64_t, uint64_t>)
+         << "-byte nodes, times in ms" << endl;
+    cout << setw(8) << "alloc" << setw(12) << "insert" << setw(12) << "find"
+         << setw(12) << "churn" << setw(12) << "clear" << endl;
+    runWorkload<NewTree>("new", keys);
+    runWorkload<PoolTree>("pool", keys);
+
+    return 0;
+}
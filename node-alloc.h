@@ -0,0 +1,214 @@
+#ifndef NODE_ALLOC_H
+#define NODE_ALLOC_H
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+* Node allocation policies for BinarySearchTree and AVLTree.
+*
+* A policy provides:
+*   template<typename NodeT, typename... Args> NodeT* create(Args&&... args);
+*   template<typename NodeT> void destroy(NodeT* node);
+*   void release();
+*   static const bool BULK_RELEASE;
+*
+* create() constructs a node, destroy() runs its destructor and gives the
+* memory back, and release() is called at the end of clear() so that a
+* policy can drop its storage in bulk. BULK_RELEASE says that release()
+* reclaims every node by itself; clear() then skips destroying nodes one
+* by one whenever their destructors are trivial.
+*/
+
+/**
+* The default policy: every node comes from global new and goes back
+* through delete.
+*/
+struct NewNodeAllocator
+{
+    template<typename NodeT, typename... Args>
+    NodeT* create(Args&&... args)
+    {
+        return new NodeT(std::forward<Args>(args)...);
+    }
+
+    template<typename NodeT>
+    void destroy(NodeT* node)
+    {
+        delete node;
+    }
+
+    void release() {}
+
+    static const bool BULK_RELEASE = false;
+};
+
+/**
+* A slab policy that carves nodes out of blocks of NodesPerBlock slots.
+* Destroyed nodes are kept on an intrusive free list and handed out again
+* before the current block is bumped, and release() frees whole blocks at
+* once. The slot size is fixed by the first node created, so one pool
+* serves exactly one node type. Pools own memory and are not copyable.
+*/
+template<size_t NodesPerBlock = 4096>
+class PoolNodeAllocator
+{
+public:
+    PoolNodeAllocator();
+    ~PoolNodeAllocator();
+
+    template<typename NodeT, typename... Args>
+    NodeT* create(Args&&... args);
+
+    template<typename NodeT>
+    void destroy(NodeT* node);
+
+    void release();
+
+    size_t blockCount() const;
+
+    static const bool BULK_RELEASE = true;
+
+private:
+    PoolNodeAllocator(const PoolNodeAllocator&) = delete;
+    PoolNodeAllocator& operator=(const PoolNodeAllocator&) = delete;
+
+    struct FreeSlot
+    {
+        FreeSlot* next;
+    };
+
+    void* allocateSlot(size_t size, size_t align);
+
+    std::vector<char*> blocks_;
+    FreeSlot* freeList_;
+    char* next_;
+    char* end_;
+    size_t slotSize_;
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the PoolNodeAllocator class.
+  ----------------------------------------------------
+*/
+
+template<size_t NodesPerBlock>
+PoolNodeAllocator<NodesPerBlock>::PoolNodeAllocator() :
+    freeList_(nullptr),
+    next_(nullptr),
+    end_(nullptr),
+    slotSize_(0)
+{
+
+}
+
+template<size_t NodesPerBlock>
+PoolNodeAllocator<NodesPerBlock>::~PoolNodeAllocator()
+{
+    release();
+}
+
+/**
+* Constructs a NodeT in a pooled slot.
+*/
+template<size_t NodesPerBlock>
+template<typename NodeT, typename... Args>
+NodeT* PoolNodeAllocator<NodesPerBlock>::create(Args&&... args)
+{
+    void* slot = allocateSlot(sizeof(NodeT), alignof(NodeT));
+    try {
+        return new (slot) NodeT(std::forward<Args>(args)...);
+    }
+    catch(...) {
+        FreeSlot* freed = static_cast<FreeSlot*>(slot);
+        freed->next = freeList_;
+        freeList_ = freed;
+        throw;
+    }
+}
+
+/**
+* Runs the node's destructor and puts its slot on the free list.
+*/
+template<size_t NodesPerBlock>
+template<typename NodeT>
+void PoolNodeAllocator<NodesPerBlock>::destroy(NodeT* node)
+{
+    if(node == nullptr) {
+        return;
+    }
+    node->~NodeT();
+    FreeSlot* freed = reinterpret_cast<FreeSlot*>(node);
+    freed->next = freeList_;
+    freeList_ = freed;
+}
+
+/**
+* Frees every block. Any node still living in the pool is discarded
+* without running its destructor.
+*/
+template<size_t NodesPerBlock>
+void PoolNodeAllocator<NodesPerBlock>::release()
+{
+    for(size_t i = 0; i < blocks_.size(); ++i) {
+        ::operator delete(blocks_[i]);
+    }
+    blocks_.clear();
+    freeList_ = nullptr;
+    next_ = nullptr;
+    end_ = nullptr;
+    slotSize_ = 0;
+}
+
+/**
+* Returns the number of blocks currently held by the pool.
+*/
+template<size_t NodesPerBlock>
+size_t PoolNodeAllocator<NodesPerBlock>::blockCount() const
+{
+    return blocks_.size();
+}
+
+template<size_t NodesPerBlock>
+void* PoolNodeAllocator<NodesPerBlock>::allocateSlot(size_t size, size_t align)
+{
+    if(slotSize_ == 0) {
+        // Round up so that consecutive slots keep the node's alignment
+        if(align < alignof(FreeSlot)) align = alignof(FreeSlot);
+        size_t slot = size < sizeof(FreeSlot) ? sizeof(FreeSlot) : size;
+        slotSize_ = (slot + align - 1) / align * align;
+    }
+    else if(size > slotSize_) {
+        throw std::logic_error("PoolNodeAllocator used for nodes of different sizes");
+    }
+
+    if(freeList_ != nullptr) {
+        FreeSlot* slot = freeList_;
+        freeList_ = slot->next;
+        return slot;
+    }
+
+    if(next_ == end_) {
+        blocks_.reserve(blocks_.size() + 1);
+        char* block = static_cast<char*>(::operator new(slotSize_ * NodesPerBlock));
+        blocks_.push_back(block);
+        next_ = block;
+        end_ = block + slotSize_ * NodesPerBlock;
+    }
+
+    void* slot = next_;
+    next_ += slotSize_;
+    return slot;
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the PoolNodeAllocator class.
+  --------------------------------------------------
+*/
+
+#endif
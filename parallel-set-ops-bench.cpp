@@ -0,0 +1,89 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+#include "thread-pool.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+typedef AVLTree<uint64_t, uint64_t> Tree;
+
+/**
+ * Builds a tree of n random keys below range with bulkLoad.
+ */
+void fillTree(Tree& t, size_t n, uint64_t range, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t k = rng() % range;
+        items[i] = make_pair(k, k);
+    }
+    t.bulkLoad(items.begin(), items.end());
+}
+
+/**
+ * Times one set operation on two fresh trees of n keys with half their
+ * keys in common. Pool is SerialInvoker or WorkStealingPool.
+ */
+template<typename Pool>
+double timeOp(int op, size_t n, Pool& pool)
+{
+    Tree a, b;
+    fillTree(a, n, 2 * n, 1);
+    fillTree(b, n, 2 * n, 2);
+    Clock::time_point start = Clock::now();
+    if(op == 0) {
+        a.unionWith(b, pool);
+    }
+    else if(op == 1) {
+        a.intersectWith(b, pool);
+    }
+    else {
+        a.subtract(b, pool);
+    }
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 2000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    const size_t threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    cout << "n = " << n << " per tree, " << thread::hardware_concurrency()
+         << " hardware threads (ms; speedup over serial)" << endl;
+    cout << setw(10) << "threads" << setw(18) << "union" << setw(18) << "intersect"
+         << setw(18) << "subtract" << endl;
+
+    SerialInvoker serial;
+    double base[3];
+    cout << setw(10) << "serial" << fixed << setprecision(1);
+    for(int op = 0; op < 3; ++op) {
+        base[op] = timeOp(op, n, serial);
+        cout << setw(10) << base[op] << setw(8) << "";
+    }
+    cout << endl;
+
+    for(size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i) {
+        WorkStealingPool pool(threadCounts[i]);
+        cout << setw(10) << threadCounts[i];
+        for(int op = 0; op < 3; ++op) {
+            double ms = timeOp(op, n, pool);
+            cout << setw(10) << ms << setw(6) << setprecision(2) << base[op] / ms << "x "
+                 << setprecision(1);
+        }
+        cout << endl;
+    }
+
+    return 0;
+}
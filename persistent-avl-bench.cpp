@@ -0,0 +1,128 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+#include "persistent-avl.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+typedef PersistentAVLTree<uint64_t, uint64_t> Tree;
+
+double msSince(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+/**
+ * Runs one writer that inserts or removes a random key and publishes the
+ * result, against readers threads that each take a snapshot and look up
+ * 100 keys in it, for ms milliseconds. Prints writes and lookups per second.
+ */
+void runMixed(const Tree& initial, size_t n, size_t readers, int ms)
+{
+    SnapshotPublisher<uint64_t, uint64_t> publisher(initial);
+    atomic<bool> stop(false);
+    atomic<size_t> lookups(0);
+    atomic<size_t> found(0);
+    vector<thread> threads;
+    for(size_t i = 0; i < readers; ++i) {
+        threads.push_back(thread([&publisher, &stop, &lookups, &found, i, n]() {
+            mt19937_64 rng(i + 1);
+            size_t done = 0;
+            size_t hits = 0;
+            while(!stop.load(memory_order_relaxed)) {
+                Tree snapshot = publisher.snapshot();
+                for(int j = 0; j < 100; ++j) {
+                    hits += snapshot.contains(rng() % (2 * n));
+                }
+                done += 100;
+            }
+            lookups.fetch_add(done);
+            found.fetch_add(hits);
+        }));
+    }
+
+    Tree tree(initial);
+    mt19937_64 rng(0);
+    size_t writes = 0;
+    Clock::time_point start = Clock::now();
+    while(msSince(start) < ms) {
+        for(int j = 0; j < 100; ++j) {
+            uint64_t key = rng() % (2 * n);
+            if(rng() % 2 == 0) {
+                tree.insert(make_pair(key, key));
+            }
+            else {
+                tree.remove(key);
+            }
+            publisher.publish(tree);
+        }
+        writes += 100;
+    }
+    stop.store(true);
+    for(size_t i = 0; i < readers; ++i) {
+        threads[i].join();
+    }
+    double seconds = msSince(start) / 1000;
+    cout << setw(10) << readers << fixed << setprecision(2)
+         << setw(16) << writes / seconds / 1e6
+         << setw(16) << lookups.load() / seconds / 1e6 << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    vector<uint64_t> keys(n);
+    mt19937_64 rng(42);
+    for(size_t i = 0; i < n; ++i) {
+        keys[i] = rng() % (2 * n);
+    }
+
+    cout << "n = " << n << " random keys" << endl;
+    cout << setw(28) << "insert all (ms)" << setw(20) << "snapshot (ns)" << endl;
+
+    AVLTree<uint64_t, uint64_t> mutableTree;
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        mutableTree.insert(make_pair(keys[i], keys[i]));
+    }
+    cout << setw(10) << "AVLTree" << fixed << setprecision(1) << setw(18) << msSince(start) << endl;
+
+    Tree tree;
+    start = Clock::now();
+    for(size_t i = 0; i < n; ++i) {
+        tree.insert(make_pair(keys[i], keys[i]));
+    }
+    double insertMs = msSince(start);
+
+    const size_t snapshots = 1000000;
+    start = Clock::now();
+    for(size_t i = 0; i < snapshots; ++i) {
+        Tree snapshot(tree);
+        if(snapshot.size() != tree.size()) {
+            return 1;
+        }
+    }
+    cout << setw(10) << "persistent" << setw(18) << insertMs
+         << setw(20) << msSince(start) * 1e6 / snapshots << endl;
+
+    cout << endl << "one writer publishing every update, readers on snapshots (M/s)" << endl;
+    cout << setw(10) << "readers" << setw(16) << "writes" << setw(16) << "lookups" << endl;
+    const size_t readerCounts[] = { 0, 1, 2, 4, 8 };
+    for(size_t i = 0; i < sizeof(readerCounts) / sizeof(readerCounts[0]); ++i) {
+        runMixed(tree, n, readerCounts[i], 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,690 @@
+#ifndef PERSISTENT_AVL_H
+#define PERSISTENT_AVL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "epoch.h"
+
+/**
+* A node of a PersistentAVLTree. Nodes never change once they are linked,
+* so one node can be shared by any number of trees; that is also why there
+* is no parent pointer. refs counts the parents and trees that point here.
+*/
+template <typename Key, typename Value>
+struct PersistentNode
+{
+    template<typename... Args>
+    PersistentNode(const PersistentNode* l, const PersistentNode* r, Args&&... itemArgs);
+
+    std::pair<const Key, Value> item;
+    const PersistentNode* left;
+    const PersistentNode* right;
+    size_t size;   // number of nodes in this subtree
+    int height;
+    mutable std::atomic<size_t> refs;
+};
+
+/**
+* An immutable-node AVL tree. insert and remove copy the O(log n) nodes on
+* the search path, including the ones a rotation touches, and leave every
+* other node shared with the previous version. Copying a tree is O(1): the
+* copy is a snapshot that later changes to either tree do not affect.
+* Nodes are reference counted and freed when the last tree using them goes
+* away, whichever thread that happens on.
+*
+* A tree object itself is not thread-safe. To hand versions from a writer
+* to concurrent readers, use SnapshotPublisher; ConcurrentAVLTree keeps
+* one tree per shard and publishes its roots the same way.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class PersistentAVLTree
+{
+public:
+    typedef PersistentNode<Key, Value> NodeType;
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp);
+    PersistentAVLTree(const PersistentAVLTree& other);
+    PersistentAVLTree(PersistentAVLTree&& other);
+    PersistentAVLTree& operator=(const PersistentAVLTree& other);
+    PersistentAVLTree& operator=(PersistentAVLTree&& other);
+    ~PersistentAVLTree();
+
+    bool insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    void clear();
+
+    bool contains(const Key& key) const;
+    bool empty() const;
+    size_t size() const;
+    int height() const;
+
+    /**
+    * An in-order iterator. It holds the path from the root to the current
+    * node, so it is only valid while some tree still shares that path.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const value_type* pointer;
+        typedef const value_type& reference;
+
+        const_iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+        const_iterator& operator++();
+
+    protected:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        void pushLeftSpine(const NodeType* node);
+
+        std::vector<const NodeType*> path_; // nodes still to visit, current on top
+    };
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+
+protected:
+    static const NodeType* retain(const NodeType* node);
+    static void release(const NodeType* node);
+    static int heightOf(const NodeType* node);
+    static size_t sizeOf(const NodeType* node);
+
+    template<typename... Args>
+    static const NodeType* makeNode(const NodeType* left, const NodeType* right, Args&&... itemArgs);
+    static const NodeType* balance(const std::pair<const Key, Value>& item,
+                                   const NodeType* left, const NodeType* right);
+    const NodeType* insertAt(const NodeType* node, const std::pair<const Key, Value>& keyValuePair,
+                             bool& added) const;
+    const NodeType* removeAt(const NodeType* node, const Key& key) const;
+    static const NodeType* removeMin(const NodeType* node, const NodeType*& min);
+
+    template <class K, class V, class C> friend class SnapshotPublisher;
+    template <class K, class V, class C> friend class ConcurrentAVLTree;
+
+    const NodeType* root_;
+    Compare comp_;
+};
+
+/**
+* Publishes versions of a PersistentAVLTree from one writer thread to any
+* number of reader threads. snapshot() is lock-free: inside an EpochGuard
+* it takes a reference on the current root and leaves. publish() never
+* waits either. It swaps the root and retires the old one with the epoch
+* it was replaced in. Each retired root is released on its own once every
+* reader still inside snapshot() entered in a later epoch, so a steady
+* stream of readers holds back only the last few versions. A reader can
+* keep using its snapshot for as long as it likes.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class SnapshotPublisher
+{
+public:
+    typedef PersistentAVLTree<Key, Value, Compare> Tree;
+
+    SnapshotPublisher();
+    explicit SnapshotPublisher(const Tree& initial);
+    ~SnapshotPublisher();
+
+    Tree snapshot() const;
+    void publish(const Tree& tree);
+    size_t retiredCount() const;
+
+private:
+    SnapshotPublisher(const SnapshotPublisher&) = delete;
+    SnapshotPublisher& operator=(const SnapshotPublisher&) = delete;
+
+    typedef typename Tree::NodeType NodeType;
+
+    // Replaced roots are kept until this many pile up
+    static const size_t RECLAIM_BATCH = 32;
+
+    void reclaim();
+
+    std::atomic<const NodeType*> root_;
+    std::vector<std::pair<const NodeType*, uint64_t> > retired_; // root, retire epoch
+    Compare comp_;
+};
+
+/*
+  -----------------------------------------------
+  Begin implementations for the PersistentNode class.
+  -----------------------------------------------
+*/
+
+template<typename Key, typename Value>
+template<typename... Args>
+PersistentNode<Key, Value>::PersistentNode(const PersistentNode* l, const PersistentNode* r, Args&&... itemArgs) :
+    item(std::forward<Args>(itemArgs)...),
+    left(l),
+    right(r),
+    size(1 + (l ? l->size : 0) + (r ? r->size : 0)),
+    height(1 + std::max(l ? l->height : 0, r ? r->height : 0)),
+    refs(1)
+{
+
+}
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ----------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    root_(nullptr),
+    comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    root_(nullptr),
+    comp_(comp)
+{
+
+}
+
+/**
+* Takes an O(1) snapshot of other.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const PersistentAVLTree& other) :
+    root_(retain(other.root_)),
+    comp_(other.comp_)
+{
+
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(PersistentAVLTree&& other) :
+    root_(other.root_),
+    comp_(other.comp_)
+{
+    other.root_ = nullptr;
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>&
+PersistentAVLTree<Key, Value, Compare>::operator=(const PersistentAVLTree& other)
+{
+    const NodeType* old = root_;
+    root_ = retain(other.root_);
+    comp_ = other.comp_;
+    release(old);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>&
+PersistentAVLTree<Key, Value, Compare>::operator=(PersistentAVLTree&& other)
+{
+    if(this != &other) {
+        release(root_);
+        root_ = other.root_;
+        comp_ = other.comp_;
+        other.root_ = nullptr;
+    }
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    release(root_);
+}
+
+/**
+* Inserts the pair, or replaces the value if the key is present. Returns
+* true if a new key was added. Snapshots taken earlier do not change.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    bool added = false;
+    const NodeType* newRoot = insertAt(root_, keyValuePair, added);
+    release(root_);
+    root_ = newRoot;
+    return added;
+}
+
+/**
+* Removes key and returns true, or returns false without copying anything
+* if it is absent. Snapshots taken earlier do not change.
+*/
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    if(!contains(key)) {
+        return false;
+    }
+    const NodeType* newRoot = removeAt(root_, key);
+    release(root_);
+    root_ = newRoot;
+    return true;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    release(root_);
+    root_ = nullptr;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    const NodeType* curr = root_;
+    while(curr != nullptr) {
+        if(comp_(key, curr->item.first)) {
+            curr = curr->left;
+        }
+        else if(comp_(curr->item.first, key)) {
+            curr = curr->right;
+        }
+        else {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return root_ == nullptr;
+}
+
+template<class Key, class Value, class Compare>
+size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return sizeOf(root_);
+}
+
+template<class Key, class Value, class Compare>
+int PersistentAVLTree<Key, Value, Compare>::height() const
+{
+    return heightOf(root_);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::begin() const
+{
+    const_iterator it;
+    it.pushLeftSpine(root_);
+    return it;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator();
+}
+
+/**
+* Returns an iterator to key, or end() if it is absent. The ancestors we
+* leave to the left of are exactly the ones still to visit in order.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator
+PersistentAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    const_iterator it;
+    const NodeType* curr = root_;
+    while(curr != nullptr) {
+        if(comp_(key, curr->item.first)) {
+            it.path_.push_back(curr);
+            curr = curr->left;
+        }
+        else if(comp_(curr->item.first, key)) {
+            curr = curr->right;
+        }
+        else {
+            it.path_.push_back(curr);
+            return it;
+        }
+    }
+    return end();
+}
+
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::retain(const NodeType* node)
+{
+    if(node != nullptr) {
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return node;
+}
+
+/**
+* Drops one reference to node, freeing it and releasing its children when
+* it was the last. Only the unshared part of a tree is ever walked, and
+* that part is balanced, so the recursion stays O(log n) deep.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::release(const NodeType* node)
+{
+    if(node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        release(node->left);
+        release(node->right);
+        delete node;
+    }
+}
+
+template<class Key, class Value, class Compare>
+int PersistentAVLTree<Key, Value, Compare>::heightOf(const NodeType* node)
+{
+    return node ? node->height : 0;
+}
+
+template<class Key, class Value, class Compare>
+size_t PersistentAVLTree<Key, Value, Compare>::sizeOf(const NodeType* node)
+{
+    return node ? node->size : 0;
+}
+
+/**
+* Creates a node that takes over the references to left and right.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::makeNode(const NodeType* left, const NodeType* right, Args&&... itemArgs)
+{
+    return new NodeType(left, right, std::forward<Args>(itemArgs)...);
+}
+
+/**
+* Builds a node for item over left and right, whose heights differ by at
+* most two, rotating copies of the nodes involved if they differ by two.
+* Takes over the references to left and right.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::balance(const std::pair<const Key, Value>& item,
+                                                const NodeType* left, const NodeType* right)
+{
+    int hl = heightOf(left);
+    int hr = heightOf(right);
+    if(hl > hr + 1) {
+        const NodeType* result;
+        if(heightOf(left->left) >= heightOf(left->right)) {
+            result = makeNode(retain(left->left),
+                              makeNode(retain(left->right), right, item),
+                              left->item);
+        }
+        else {
+            const NodeType* pivot = left->right;
+            result = makeNode(makeNode(retain(left->left), retain(pivot->left), left->item),
+                              makeNode(retain(pivot->right), right, item),
+                              pivot->item);
+        }
+        release(left);
+        return result;
+    }
+    if(hr > hl + 1) {
+        const NodeType* result;
+        if(heightOf(right->right) >= heightOf(right->left)) {
+            result = makeNode(makeNode(left, retain(right->left), item),
+                              retain(right->right),
+                              right->item);
+        }
+        else {
+            const NodeType* pivot = right->left;
+            result = makeNode(makeNode(left, retain(pivot->left), item),
+                              makeNode(retain(pivot->right), retain(right->right), right->item),
+                              pivot->item);
+        }
+        release(right);
+        return result;
+    }
+    return makeNode(left, right, item);
+}
+
+/**
+* Returns a new reference to a copy of node's subtree with the pair in it.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::insertAt(const NodeType* node, const std::pair<const Key, Value>& keyValuePair,
+                                                 bool& added) const
+{
+    if(node == nullptr) {
+        added = true;
+        return makeNode(nullptr, nullptr, keyValuePair);
+    }
+    if(comp_(keyValuePair.first, node->item.first)) {
+        return balance(node->item, insertAt(node->left, keyValuePair, added), retain(node->right));
+    }
+    if(comp_(node->item.first, keyValuePair.first)) {
+        return balance(node->item, retain(node->left), insertAt(node->right, keyValuePair, added));
+    }
+    return makeNode(retain(node->left), retain(node->right), node->item.first, keyValuePair.second);
+}
+
+/**
+* Returns a new reference to a copy of node's subtree without key, which
+* must be present.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removeAt(const NodeType* node, const Key& key) const
+{
+    if(comp_(key, node->item.first)) {
+        return balance(node->item, removeAt(node->left, key), retain(node->right));
+    }
+    if(comp_(node->item.first, key)) {
+        return balance(node->item, retain(node->left), removeAt(node->right, key));
+    }
+    if(node->left == nullptr) {
+        return retain(node->right);
+    }
+    if(node->right == nullptr) {
+        return retain(node->left);
+    }
+    const NodeType* min = nullptr;
+    const NodeType* right = removeMin(node->right, min);
+    return balance(min->item, retain(node->left), right);
+}
+
+/**
+* Returns a new reference to a copy of node's subtree without its smallest
+* node, which is stored in min. min stays alive through node.
+*/
+template<class Key, class Value, class Compare>
+const typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removeMin(const NodeType* node, const NodeType*& min)
+{
+    if(node->left == nullptr) {
+        min = node;
+        return retain(node->right);
+    }
+    return balance(node->item, removeMin(node->left, min), retain(node->right));
+}
+
+/*
+  -------------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::const_iterator class.
+  -------------------------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::const_iterator::const_iterator()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::reference
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return path_.back()->item;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator::pointer
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(path_.back()->item);
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    if(path_.empty() || rhs.path_.empty()) {
+        return path_.empty() == rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    const NodeType* curr = path_.back();
+    path_.pop_back();
+    pushLeftSpine(curr->right);
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::const_iterator::pushLeftSpine(const NodeType* node)
+{
+    while(node != nullptr) {
+        path_.push_back(node);
+        node = node->left;
+    }
+}
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the SnapshotPublisher class.
+  ----------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+SnapshotPublisher<Key, Value, Compare>::SnapshotPublisher() :
+    root_(nullptr),
+    comp_()
+{
+
+}
+
+template<class Key, class Value, class Compare>
+SnapshotPublisher<Key, Value, Compare>::SnapshotPublisher(const Tree& initial) :
+    root_(Tree::retain(initial.root_)),
+    comp_(initial.comp_)
+{
+
+}
+
+/**
+* No reader may be inside snapshot() by now, so every retired root can go
+* at once.
+*/
+template<class Key, class Value, class Compare>
+SnapshotPublisher<Key, Value, Compare>::~SnapshotPublisher()
+{
+    Tree::release(root_.load());
+    for(size_t i = 0; i < retired_.size(); ++i) {
+        Tree::release(retired_[i].first);
+    }
+}
+
+/**
+* Returns the most recently published tree. Safe to call from any thread
+* while the writer publishes.
+*/
+template<class Key, class Value, class Compare>
+typename SnapshotPublisher<Key, Value, Compare>::Tree
+SnapshotPublisher<Key, Value, Compare>::snapshot() const
+{
+    Tree tree(comp_);
+    EpochGuard guard;
+    tree.root_ = Tree::retain(root_.load());
+    return tree;
+}
+
+/**
+* Makes tree the version that snapshot() returns. Only one thread may
+* publish at a time.
+*/
+template<class Key, class Value, class Compare>
+void SnapshotPublisher<Key, Value, Compare>::publish(const Tree& tree)
+{
+    retired_.reserve(retired_.size() + 1);
+    const NodeType* old = root_.exchange(Tree::retain(tree.root_));
+    if(old == nullptr) {
+        return;
+    }
+    retired_.push_back(std::make_pair(old, EpochDomain::instance().current()));
+    if(retired_.size() >= RECLAIM_BATCH) {
+        reclaim();
+    }
+}
+
+/**
+* Returns how many replaced roots are waiting to be released. Only the
+* publishing thread may call this.
+*/
+template<class Key, class Value, class Compare>
+size_t SnapshotPublisher<Key, Value, Compare>::retiredCount() const
+{
+    return retired_.size();
+}
+
+/**
+* Starts a new epoch and releases the retired roots no reader can still
+* be loading. A reader that loaded one has retained it by the time it
+* leaves snapshot(), and nodes shared with newer versions stay alive
+* through their reference counts.
+*/
+template<class Key, class Value, class Compare>
+void SnapshotPublisher<Key, Value, Compare>::reclaim()
+{
+    EpochDomain& domain = EpochDomain::instance();
+    domain.advance();
+    uint64_t oldest = domain.oldestActive();
+    size_t kept = 0;
+    for(size_t i = 0; i < retired_.size(); ++i) {
+        if(retired_[i].second < oldest) {
+            Tree::release(retired_[i].first);
+        }
+        else {
+            retired_[kept++] = retired_[i];
+        }
+    }
+    retired_.resize(kept);
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the SnapshotPublisher class.
+  --------------------------------------------------
+*/
+
+#endif
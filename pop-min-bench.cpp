@@ -0,0 +1,124 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <queue>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+typedef AVLTree<uint64_t, uint64_t> Tree;
+
+/**
+ * The work-queue pattern: keep n items queued, and for each of ops steps
+ * take the earliest one and schedule a new item a random delay after it.
+ * Each function returns ns per pop+push and a checksum of popped keys.
+ */
+double runFindRemove(size_t n, size_t ops, uint64_t& sum)
+{
+    mt19937_64 rng(104);
+    Tree t;
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t k = rng() >> 20;
+        t.insert(make_pair(k, k));
+    }
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        uint64_t k = t.begin()->first;
+        t.remove(k);
+        sum += k;
+        uint64_t next = k + (rng() >> 40);
+        t.insert(make_pair(next, next));
+    }
+    return chrono::duration<double, nano>(Clock::now() - start).count() / ops;
+}
+
+double runPopMin(size_t n, size_t ops, uint64_t& sum)
+{
+    mt19937_64 rng(104);
+    Tree t;
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t k = rng() >> 20;
+        t.insert(make_pair(k, k));
+    }
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        uint64_t k = t.popMin().first;
+        sum += k;
+        uint64_t next = k + (rng() >> 40);
+        t.insert(make_pair(next, next));
+    }
+    return chrono::duration<double, nano>(Clock::now() - start).count() / ops;
+}
+
+double runPriorityQueue(size_t n, size_t ops, uint64_t& sum)
+{
+    mt19937_64 rng(104);
+    priority_queue<pair<uint64_t, uint64_t>, vector<pair<uint64_t, uint64_t> >,
+                   greater<pair<uint64_t, uint64_t> > > q;
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t k = rng() >> 20;
+        q.push(make_pair(k, k));
+    }
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        uint64_t k = q.top().first;
+        q.pop();
+        sum += k;
+        uint64_t next = k + (rng() >> 40);
+        q.push(make_pair(next, next));
+    }
+    return chrono::duration<double, nano>(Clock::now() - start).count() / ops;
+}
+
+double runMultimap(size_t n, size_t ops, uint64_t& sum)
+{
+    mt19937_64 rng(104);
+    multimap<uint64_t, uint64_t> m;
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t k = rng() >> 20;
+        m.insert(make_pair(k, k));
+    }
+    Clock::time_point start = Clock::now();
+    for(size_t i = 0; i < ops; ++i) {
+        uint64_t k = m.begin()->first;
+        m.erase(m.begin());
+        sum += k;
+        uint64_t next = k + (rng() >> 40);
+        m.insert(make_pair(next, next));
+    }
+    return chrono::duration<double, nano>(Clock::now() - start).count() / ops;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t maxN = 1000000;
+    if(argc > 1) {
+        maxN = strtoul(argv[1], NULL, 10);
+    }
+    size_t ops = 1000000;
+
+    // The checksums only keep the loops from being optimized away; the
+    // priority queue and multimap may keep duplicate keys the trees merge.
+    cout << "ns per pop+push, " << ops << " operations" << endl;
+    cout << setw(10) << "queued" << setw(14) << "find+remove" << setw(12) << "popMin"
+         << setw(16) << "priority_queue" << setw(12) << "multimap" << endl;
+    uint64_t sum = 0;
+    for(size_t n = maxN / 100; n <= maxN; n *= 10) {
+        cout << setw(10) << n << fixed << setprecision(1)
+             << setw(14) << runFindRemove(n, ops, sum)
+             << setw(12) << runPopMin(n, ops, sum)
+             << setw(16) << runPriorityQueue(n, ops, sum)
+             << setw(12) << runMultimap(n, ops, sum) << endl;
+    }
+    cout << "(checksum " << sum << ")" << endl;
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+/**
+ * Builds a tree of n sequential keys, then erases k contiguous keys from
+ * the middle either with one range erase or with k single erases, and
+ * returns the time of the erase alone in microseconds.
+ */
+template<typename Tree>
+double timeRange(size_t n, size_t k, bool oneCall)
+{
+    vector<pair<uint64_t, uint64_t> > items(n);
+    for(size_t i = 0; i < n; ++i) {
+        items[i] = make_pair(i, i);
+    }
+    Tree t(items.begin(), items.end());
+    typename Tree::iterator first = t.find(n / 2 - k / 2);
+    typename Tree::iterator last = t.find(n / 2 - k / 2 + k);
+
+    Clock::time_point start = Clock::now();
+    if(oneCall) {
+        t.erase(first, last);
+    }
+    else {
+        while(first != last) {
+            first = t.erase(first);
+        }
+    }
+    return chrono::duration<double, micro>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    // The range erase should grow with k alone, plus a small log n term.
+    cout << "n = " << n << " (us per erase call)" << endl;
+    cout << setw(10) << "k" << setw(14) << "AVL range" << setw(14) << "AVL k x 1"
+         << setw(14) << "map range" << endl;
+    for(size_t k = 10; k <= n / 2; k *= 10) {
+        cout << setw(10) << k << fixed << setprecision(1)
+             << setw(14) << timeRange<AVLTree<uint64_t, uint64_t> >(n, k, true)
+             << setw(14) << timeRange<AVLTree<uint64_t, uint64_t> >(n, k, false)
+             << setw(14) << timeRange<map<uint64_t, uint64_t> >(n, k, true) << endl;
+    }
+
+    return 0;
+}
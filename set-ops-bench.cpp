@@ -0,0 +1,102 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+typedef AVLTree<uint64_t, uint64_t> Tree;
+
+/**
+ * Makes a tree of n random keys below range.
+ */
+void fillTree(Tree& t, size_t n, uint64_t range, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t k = rng() % range;
+        t.insert(make_pair(k, k));
+    }
+}
+
+double msSince(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+/**
+ * Merges a tree of m keys into one of n keys, once by inserting the small
+ * tree's items one at a time and once with each join-based operation.
+ */
+void timeSizes(size_t n, size_t m)
+{
+    uint64_t range = 4 * n;
+    cout << setw(10) << n << setw(10) << m << fixed << setprecision(2);
+    {
+        Tree big, small;
+        fillTree(big, n, range, 1);
+        fillTree(small, m, range, 2);
+        Clock::time_point start = Clock::now();
+        for(Tree::iterator it = small.begin(); it != small.end(); ++it) {
+            big.insert(*it);
+        }
+        cout << setw(12) << msSince(start);
+    }
+    {
+        Tree big, small;
+        fillTree(big, n, range, 1);
+        fillTree(small, m, range, 2);
+        Clock::time_point start = Clock::now();
+        big.unionWith(small);
+        cout << setw(12) << msSince(start);
+    }
+    {
+        Tree big, small;
+        fillTree(big, n, range, 1);
+        fillTree(small, m, range, 2);
+        Clock::time_point start = Clock::now();
+        small.intersectWith(big);
+        cout << setw(12) << msSince(start);
+    }
+    {
+        Tree big, small;
+        fillTree(big, n, range, 1);
+        fillTree(small, m, range, 2);
+        Clock::time_point start = Clock::now();
+        big.subtract(small);
+        cout << setw(12) << msSince(start);
+    }
+    {
+        Tree big, right;
+        fillTree(big, n, range, 1);
+        Clock::time_point start = Clock::now();
+        big.split(range / 2, right);
+        big.join(right);
+        cout << setw(14) << msSince(start) * 1000 << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 1000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    // For m much smaller than n the set operations cost O(m log(n/m + 1)),
+    // except that intersect also has to free the larger tree's other nodes.
+    cout << "ms per operation (split+join in us)" << endl;
+    cout << setw(10) << "n" << setw(10) << "m" << setw(12) << "insert" << setw(12) << "union"
+         << setw(12) << "intersect" << setw(12) << "subtract" << setw(14) << "split+join" << endl;
+    for(size_t m = 100; m <= n; m *= 10) {
+        timeSizes(n, m);
+    }
+
+    return 0;
+}
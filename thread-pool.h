@@ -0,0 +1,262 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* A fork-join pool of std::threads with one task deque per thread, for the
+* parallel set operations of AVLTree. invoke(f, g) pushes g onto the back
+* of the calling thread's deque and runs f itself. Idle threads steal from
+* the other deques. Once f is done, the caller takes g back and runs it
+* unless it was stolen, in which case it runs other tasks until g is done.
+* Threads from outside the pool all share slot 0.
+*/
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(size_t threads = std::thread::hardware_concurrency());
+    ~WorkStealingPool();
+
+    size_t size() const;
+
+    template<typename F, typename G>
+    void invoke(F f, G g);
+
+private:
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    struct Task
+    {
+        Task() : done(false) {}
+
+        std::function<void()> fn;
+        std::atomic<bool> done;
+        std::exception_ptr error;
+    };
+
+    struct Slot
+    {
+        std::mutex lock;
+        std::deque<Task*> tasks;
+    };
+
+    struct WorkerId
+    {
+        const WorkStealingPool* pool;
+        size_t slot;
+    };
+
+    static WorkerId& workerId();
+    size_t currentSlot() const;
+    void push(size_t slot, Task* task);
+    bool takeBack(size_t slot, Task* task);
+    bool runOne(size_t slot);
+    static void run(Task* task);
+    void workerLoop(size_t slot);
+
+    std::vector<std::unique_ptr<Slot> > slots_;
+    std::vector<std::thread> threads_;
+    std::atomic<size_t> queued_;
+    std::atomic<bool> stop_;
+    std::mutex sleepLock_;
+    std::condition_variable wake_;
+};
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the WorkStealingPool class.
+  ---------------------------------------------------
+*/
+
+/**
+* Starts threads - 1 workers; the thread calling invoke is the last one.
+*/
+inline WorkStealingPool::WorkStealingPool(size_t threads) :
+    queued_(0),
+    stop_(false)
+{
+    if(threads == 0) {
+        threads = 1;
+    }
+    for(size_t i = 0; i < threads; ++i) {
+        slots_.push_back(std::unique_ptr<Slot>(new Slot));
+    }
+    for(size_t i = 1; i < threads; ++i) {
+        threads_.push_back(std::thread(&WorkStealingPool::workerLoop, this, i));
+    }
+}
+
+inline WorkStealingPool::~WorkStealingPool()
+{
+    stop_.store(true);
+    {
+        std::lock_guard<std::mutex> guard(sleepLock_);
+    }
+    wake_.notify_all();
+    for(size_t i = 0; i < threads_.size(); ++i) {
+        threads_[i].join();
+    }
+}
+
+/**
+* Returns the number of threads that work on tasks, counting the caller.
+*/
+inline size_t WorkStealingPool::size() const
+{
+    return slots_.size();
+}
+
+/**
+* Runs f and g, possibly in parallel, and returns once both are done. If
+* either throws, the exception is rethrown here after both have finished.
+*/
+template<typename F, typename G>
+void WorkStealingPool::invoke(F f, G g)
+{
+    size_t slot = currentSlot();
+    Task task;
+    task.fn = g;
+    push(slot, &task);
+
+    std::exception_ptr error;
+    try {
+        f();
+    }
+    catch(...) {
+        error = std::current_exception();
+    }
+
+    if(takeBack(slot, &task)) {
+        run(&task);
+    }
+    else {
+        while(!task.done.load(std::memory_order_acquire)) {
+            if(!runOne(slot)) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    if(task.error) {
+        std::rethrow_exception(task.error);
+    }
+}
+
+inline WorkStealingPool::WorkerId& WorkStealingPool::workerId()
+{
+    static thread_local WorkerId id = { nullptr, 0 };
+    return id;
+}
+
+inline size_t WorkStealingPool::currentSlot() const
+{
+    const WorkerId& id = workerId();
+    return id.pool == this ? id.slot : 0;
+}
+
+inline void WorkStealingPool::push(size_t slot, Task* task)
+{
+    {
+        std::lock_guard<std::mutex> guard(slots_[slot]->lock);
+        slots_[slot]->tasks.push_back(task);
+    }
+    queued_.fetch_add(1);
+    wake_.notify_one();
+}
+
+/**
+* Removes task from the slot's deque if it is still there. Whoever removes
+* a task from a deque is the one that runs it.
+*/
+inline bool WorkStealingPool::takeBack(size_t slot, Task* task)
+{
+    std::lock_guard<std::mutex> guard(slots_[slot]->lock);
+    std::deque<Task*>& tasks = slots_[slot]->tasks;
+    for(std::deque<Task*>::reverse_iterator it = tasks.rbegin(); it != tasks.rend(); ++it) {
+        if(*it == task) {
+            tasks.erase(std::next(it).base());
+            queued_.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+* Runs one task, newest first from the slot's own deque, otherwise the
+* oldest task of another slot. Returns false if every deque was empty.
+*/
+inline bool WorkStealingPool::runOne(size_t slot)
+{
+    for(size_t i = 0; i < slots_.size(); ++i) {
+        size_t victim = (slot + i) % slots_.size();
+        Task* task = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(slots_[victim]->lock);
+            std::deque<Task*>& tasks = slots_[victim]->tasks;
+            if(!tasks.empty()) {
+                if(i == 0) {
+                    task = tasks.back();
+                    tasks.pop_back();
+                }
+                else {
+                    task = tasks.front();
+                    tasks.pop_front();
+                }
+            }
+        }
+        if(task != nullptr) {
+            queued_.fetch_sub(1);
+            run(task);
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void WorkStealingPool::run(Task* task)
+{
+    try {
+        task->fn();
+    }
+    catch(...) {
+        task->error = std::current_exception();
+    }
+    task->done.store(true, std::memory_order_release);
+}
+
+inline void WorkStealingPool::workerLoop(size_t slot)
+{
+    workerId().pool = this;
+    workerId().slot = slot;
+    while(!stop_.load()) {
+        if(!runOne(slot)) {
+            std::unique_lock<std::mutex> sleeping(sleepLock_);
+            wake_.wait_for(sleeping, std::chrono::milliseconds(1), [this]() {
+                return stop_.load() || queued_.load() > 0;
+            });
+        }
+    }
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the WorkStealingPool class.
+  -------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef TREE_SHAPE_H
+#define TREE_SHAPE_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+/**
+* Shape statistics of a binary tree, gathered by profileShape in a single
+* walk. Depths count edges from the root, so the root is at depth 0 and
+* height is the number of levels.
+*/
+struct TreeShape
+{
+    TreeShape();
+
+    size_t nodes;
+    size_t leaves;
+    int height;
+    int minLeafDepth;                 // -1 for an empty tree
+    int maxLeafDepth;                 // -1 for an empty tree
+    std::vector<size_t> leafDepths;   // leafDepths[d] = leaves at depth d
+    std::vector<size_t> levelWidths;  // levelWidths[d] = nodes at depth d
+
+    bool equalPaths() const;
+};
+
+inline TreeShape::TreeShape() :
+    nodes(0),
+    leaves(0),
+    height(0),
+    minLeafDepth(-1),
+    maxLeafDepth(-1)
+{
+
+}
+
+/**
+* Returns true if every leaf is at the same depth, as equalPaths does.
+*/
+inline bool TreeShape::equalPaths() const
+{
+    return minLeafDepth == maxLeafDepth;
+}
+
+// Child access for the two node types in this repo: the equal-paths Node
+// has public left and right members, while the BST Node<Key, Value> has
+// getLeft() and getRight(). The int overload wins when both would work.
+template<typename NodeT>
+auto shapeLeft(const NodeT* node, int) -> decltype(node->getLeft())
+{
+    return node->getLeft();
+}
+
+template<typename NodeT>
+auto shapeLeft(const NodeT* node, long) -> decltype(node->left)
+{
+    return node->left;
+}
+
+template<typename NodeT>
+auto shapeRight(const NodeT* node, int) -> decltype(node->getRight())
+{
+    return node->getRight();
+}
+
+template<typename NodeT>
+auto shapeRight(const NodeT* node, long) -> decltype(node->right)
+{
+    return node->right;
+}
+
+/**
+* Walks the tree at root, taken to be at depth, without recursion. The walk
+* runs down to each leaf and stacks only the right children it passes over,
+* so chains cost no stack traffic. visitNode(depth) is called for every
+* node and visitLeaf(depth) for every leaf; the walk stops as soon as
+* visitLeaf returns false.
+*/
+template<typename NodeT, typename VisitNode, typename VisitLeaf>
+void walkLeaves(const NodeT* root, int depth, VisitNode visitNode, VisitLeaf visitLeaf)
+{
+    if(root == nullptr) {
+        return;
+    }
+
+    std::vector<std::pair<const NodeT*, int> > pending;
+    const NodeT* node = root;
+    while(true) {
+        while(true) {
+            visitNode(depth);
+
+            const NodeT* left = shapeLeft(node, 0);
+            const NodeT* right = shapeRight(node, 0);
+            if(left == nullptr && right == nullptr) {
+                break;
+            }
+            if(left == nullptr) {
+                node = right;
+            }
+            else {
+                if(right != nullptr) {
+                    pending.push_back(std::make_pair(right, depth + 1));
+                }
+                node = left;
+            }
+            ++depth;
+        }
+
+        if(!visitLeaf(depth) || pending.empty()) {
+            return;
+        }
+        node = pending.back().first;
+        depth = pending.back().second;
+        pending.pop_back();
+    }
+}
+
+/**
+* Profiles the tree at root in one pass of walkLeaves.
+*/
+template<typename NodeT>
+TreeShape profileShape(const NodeT* root)
+{
+    TreeShape shape;
+    walkLeaves(root, 0,
+        [&shape](int depth) {
+            size_t d = static_cast<size_t>(depth);
+            if(d == shape.levelWidths.size()) {
+                shape.levelWidths.push_back(0);
+            }
+            ++shape.levelWidths[d];
+        },
+        [&shape](int depth) {
+            size_t d = static_cast<size_t>(depth);
+            if(shape.leafDepths.size() <= d) {
+                shape.leafDepths.resize(d + 1, 0);
+            }
+            ++shape.leafDepths[d];
+            return true;
+        });
+
+    shape.height = static_cast<int>(shape.levelWidths.size());
+    for(size_t d = 0; d < shape.levelWidths.size(); ++d) {
+        shape.nodes += shape.levelWidths[d];
+    }
+    for(size_t d = 0; d < shape.leafDepths.size(); ++d) {
+        if(shape.leafDepths[d] == 0) {
+            continue;
+        }
+        if(shape.minLeafDepth < 0) {
+            shape.minLeafDepth = static_cast<int>(d);
+        }
+        shape.maxLeafDepth = static_cast<int>(d);
+        shape.leaves += shape.leafDepths[d];
+    }
+    return shape;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstdlib>
+#include "bst.h"
+#include "avlbst.h"
+#include "thread-pool.h"
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+typedef AVLTree<uint64_t, uint64_t> Tree;
+typedef AVLNode<uint64_t, uint64_t, NoAugment> TreeNode;
+
+/**
+ * Gives the benchmark the root, which the tree keeps to itself.
+ */
+class InspectTree : public Tree
+{
+public:
+    TreeNode* root() const { return static_cast<TreeNode*>(this->root_); }
+};
+
+/**
+ * The old way to check balances: a fresh height walk of both children at
+ * every node, so each node is visited once per ancestor.
+ */
+int heightOf(TreeNode* node)
+{
+    if(node == nullptr) {
+        return 0;
+    }
+    return 1 + max(heightOf(node->getLeft()), heightOf(node->getRight()));
+}
+
+bool balancesPerNode(TreeNode* node)
+{
+    if(node == nullptr) {
+        return true;
+    }
+    if(node->getBalance() != heightOf(node->getRight()) - heightOf(node->getLeft())) {
+        return false;
+    }
+    return balancesPerNode(node->getLeft()) && balancesPerNode(node->getRight());
+}
+
+double msSince(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+int main(int argc, char *argv[])
+{
+    size_t n = 4000000;
+    if(argc > 1) {
+        n = strtoul(argv[1], NULL, 10);
+    }
+
+    // Random inserts and removals, so the balances are a realistic mix
+    InspectTree t;
+    mt19937_64 rng(1);
+    for(size_t i = 0; i < n + n / 4; ++i) {
+        t.insert(make_pair(rng() % (2 * n), i));
+        if(i % 5 == 4) {
+            t.remove(rng() % (2 * n));
+        }
+    }
+    cout << "checking an AVL tree of height " << t.shape().height << ", "
+         << thread::hardware_concurrency() << " hardware threads (ms)" << endl;
+
+    Clock::time_point start = Clock::now();
+    bool ok = balancesPerNode(t.root());
+    cout << setw(24) << "height walk per node" << fixed << setprecision(1) << setw(12) << msSince(start) << endl;
+
+    start = Clock::now();
+    t.verify();
+    double serial = msSince(start);
+    cout << setw(24) << "verify" << setw(12) << serial << endl;
+
+    const size_t threadCounts[] = { 1, 2, 4, 8, 16, 32 };
+    for(size_t i = 0; i < sizeof(threadCounts) / sizeof(threadCounts[0]); ++i) {
+        WorkStealingPool pool(threadCounts[i]);
+        start = Clock::now();
+        t.verify(pool);
+        double ms = msSince(start);
+        cout << setw(14) << "verify, " << setw(2) << threadCounts[i] << " threads"
+             << setw(12) << ms << setw(7) << serial / ms << "x" << endl;
+    }
+    return ok ? 0 : 1;
+}